@@ -3,22 +3,100 @@
 #include <thread>
 #include <future>
 #include <numeric>
+#include <iterator>
 #include <algorithm>
+#include <functional>
+#include "thread_pool.h"
+#include "grain_size.h"
+#include "cancellation.h"
 
 template <typename Iterator, typename T>
-T async_accumulate(Iterator first, Iterator last, T init)
+T async_accumulate_impl(Iterator first, Iterator last, T init, unsigned long grain, cancellation_scope& scope)
 {
-    unsigned long const length = std::distance(first, last);
-    unsigned long const max_chunk_size = 25;
-    if (length > max_chunk_size)
+    try
     {
-        Iterator mid_point = first;
-        std::advance(mid_point, length / 2);
-        std::future<T> first_half_result = std::async(async_accumulate<Iterator, T>, first, mid_point, init);
-        T second_half_result = async_accumulate(mid_point, last, T());
-        return first_half_result.get() + second_half_result;
+        unsigned long const length = std::distance(first, last);
+        if (scope.stop_requested())
+        {
+            return init;
+        }
+        if (length > grain)
+        {
+            Iterator mid_point = first;
+            std::advance(mid_point, length / 2);
+            std::future<T> first_half_result = std::async(&async_accumulate_impl<Iterator, T>, first, mid_point, init, grain, std::ref(scope));
+            T second_half_result = async_accumulate_impl(mid_point, last, T(), grain, scope);
+            return first_half_result.get() + second_half_result;
+        }
+        return std::accumulate(first, last, init);
     }
-    return std::accumulate(first, last, init);
+    catch (...)
+    {
+        scope.request_stop();
+        throw;
+    }
+}
+
+template <typename Iterator, typename T>
+T async_accumulate(Iterator first, Iterator last, T init, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first, last);
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&init](Iterator block_start, Iterator block_end) {
+            init = std::accumulate(block_start, block_end, init);
+            return true;
+        });
+    }
+    T result = async_accumulate_impl(first, last, init, grain, scope);
+    scope.throw_if_cancelled();
+    return result;
+}
+
+template <typename Iterator, typename T>
+T async_accumulate_impl(thread_pool& pool, Iterator first, Iterator last, T init, unsigned long grain, cancellation_scope& scope)
+{
+    try
+    {
+        unsigned long const length = std::distance(first, last);
+        if (scope.stop_requested())
+        {
+            return init;
+        }
+        if (length > grain)
+        {
+            Iterator mid_point = first;
+            std::advance(mid_point, length / 2);
+            pool_future<T> first_half_result = pool.submit([&pool, first, mid_point, init, grain, &scope] { return async_accumulate_impl(pool, first, mid_point, init, grain, scope); });
+            T second_half_result = async_accumulate_impl(pool, mid_point, last, T(), grain, scope);
+            return first_half_result.get() + second_half_result;
+        }
+        return std::accumulate(first, last, init);
+    }
+    catch (...)
+    {
+        scope.request_stop();
+        throw;
+    }
+}
+
+template <typename Iterator, typename T>
+T async_accumulate(thread_pool& pool, Iterator first, Iterator last, T init, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first, last);
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, pool_task_target, [&init](Iterator block_start, Iterator block_end) {
+            init = std::accumulate(block_start, block_end, init);
+            return true;
+        });
+    }
+    T result = length > grain && !pool.in_worker() ? pool.submit([&pool, first, last, init, grain, &scope] { return async_accumulate_impl(pool, first, last, init, grain, scope); }).get()
+                                                   : async_accumulate_impl(pool, first, last, init, grain, scope);
+    scope.throw_if_cancelled();
+    return result;
 }
 
 int main()
@@ -31,5 +109,28 @@ int main()
     const auto end = std::chrono::steady_clock::now();
     std::cout << "Time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
 
+    thread_pool pool;
+    const auto pool_start = std::chrono::steady_clock::now();
+    std::cout << "Pool sum: " << async_accumulate(pool, v.begin(), v.end(), 0LL) << std::endl;
+
+    const auto pool_end = std::chrono::steady_clock::now();
+    std::cout << "Pool time: " << std::chrono::duration_cast<std::chrono::microseconds>(pool_end - pool_start).count() << "us" << std::endl;
+
+    unsigned long const task_count = 100000;
+    std::vector<pool_future<void>> fs(task_count);
+    const auto submit_start = std::chrono::steady_clock::now();
+    for (auto& f : fs)
+    {
+        f = pool.submit([] {});
+    }
+    const auto submit_end = std::chrono::steady_clock::now();
+    for (auto& f : fs)
+    {
+        f.get();
+    }
+    thread_pool single_pool(1);
+    std::cout << "Single worker pool sum: " << async_accumulate(single_pool, v.begin(), v.end(), 0LL) << std::endl;
+    std::cout << "Pool submit: " << std::chrono::duration<double, std::nano>(submit_end - submit_start).count() / task_count << "ns per task" << std::endl;
+
     return 0;
 }
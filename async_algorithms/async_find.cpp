@@ -5,44 +5,148 @@
 #include <chrono>
 #include <numeric>
 #include <iterator>
+#include <algorithm>
+#include <atomic>
+#include "thread_pool.h"
+#include "grain_size.h"
+#include "simd_kernels.h"
+#include "cancellation.h"
 
+inline void fetch_min(std::atomic<unsigned long>& best, unsigned long value)
+{
+    unsigned long current = best.load();
+    while (value < current && !best.compare_exchange_weak(current, value))
+    {
+    }
+}
+
+// best holds the lowest matching offset from origin seen so far. A leaf only gives up once a match before its own start
+// is known, so the left half always finishes and its match wins over the right half's.
 template <typename Iterator, typename MatchType>
-Iterator async_find_impl(Iterator first, Iterator last, MatchType match, std::atomic<bool>& done)
+Iterator find_leaf(Iterator origin, Iterator first, Iterator last, MatchType const& match, std::atomic<unsigned long>& best, cancellation_scope& scope)
+{
+    unsigned long const offset = std::distance(origin, first);
+    Iterator const it = block_find(first, last, match, [&best, &scope, offset] { return best.load() < offset || scope.stop_requested(); });
+    if (it != last)
+    {
+        fetch_min(best, offset + std::distance(first, it));
+    }
+    return it;
+}
+
+template <typename Iterator, typename MatchType>
+Iterator async_find_impl(Iterator origin, Iterator first, Iterator last, MatchType match, unsigned long grain, std::atomic<unsigned long>& best, cancellation_scope& scope)
 {
     try
     {
         unsigned long const length = std::distance(first, last);
-        unsigned long const min_per_thread = 25;
-        if (length < 2 * min_per_thread)
+        if (scope.stop_requested())
         {
-            while (first != last && !done.load())
-            {
-                if (*first == match)
-                {
-                    done = true;
-                    return first;
-                }
-                ++first;
-            }
             return last;
         }
+        if (length < 2 * grain)
+        {
+            return find_leaf(origin, first, last, match, best, scope);
+        }
         Iterator const mid_point = first + (length / 2);
-        std::future<Iterator> async_result = std::async(&async_find_impl<Iterator, MatchType>, mid_point, last, match, std::ref(done));
-        Iterator const direct_result = async_find_impl(first, mid_point, match, done);
+        std::future<Iterator> async_result = std::async(&async_find_impl<Iterator, MatchType>, origin, mid_point, last, match, grain, std::ref(best), std::ref(scope));
+        Iterator const direct_result = async_find_impl(origin, first, mid_point, match, grain, best, scope);
         return direct_result == mid_point ? async_result.get() : direct_result;
     }
     catch (...)
     {
-        done = true;
+        scope.request_stop();
+        throw;
+    }
+}
+
+template <typename Iterator, typename MatchType>
+Iterator find_probe(Iterator& first, Iterator last, MatchType const& match, std::chrono::nanoseconds target_task, unsigned long& grain)
+{
+    unsigned long length = std::distance(first, last);
+    Iterator found = last;
+    grain = probe_grain_size(first, length, target_task, [&found, &match](Iterator block_start, Iterator block_end) {
+        Iterator const it = block_find(block_start, block_end, match);
+        if (it != block_end)
+        {
+            found = it;
+            return false;
+        }
+        return true;
+    });
+    return found;
+}
+
+template <typename Iterator, typename MatchType>
+Iterator async_find(Iterator first, Iterator last, MatchType match, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    cancellation_scope scope(token);
+    if (grain == auto_grain)
+    {
+        Iterator const found = find_probe(first, last, match, thread_task_target, grain);
+        if (found != last)
+        {
+            return found;
+        }
+    }
+    std::atomic<unsigned long> best(std::distance(first, last));
+    Iterator const result = async_find_impl(first, first, last, match, grain, best, scope);
+    scope.throw_if_cancelled();
+    return result;
+}
+
+template <typename Iterator, typename MatchType>
+Iterator async_find_impl(thread_pool& pool, Iterator origin, Iterator first, Iterator last, MatchType match, unsigned long grain, std::atomic<unsigned long>& best, cancellation_scope& scope)
+{
+    unsigned long const length = std::distance(first, last);
+    if (scope.stop_requested())
+    {
+        return last;
+    }
+    if (length < 2 * grain)
+    {
+        try
+        {
+            return find_leaf(origin, first, last, match, best, scope);
+        }
+        catch (...)
+        {
+            scope.request_stop();
+            throw;
+        }
+    }
+    Iterator const mid_point = first + (length / 2);
+    pool_future<Iterator> async_result = pool.submit([&pool, origin, mid_point, last, match, grain, &best, &scope] { return async_find_impl(pool, origin, mid_point, last, match, grain, best, scope); });
+    Iterator direct_result;
+    try
+    {
+        direct_result = async_find_impl(pool, origin, first, mid_point, match, grain, best, scope);
+    }
+    catch (...)
+    {
+        scope.request_stop();
         throw;
     }
+    return direct_result == mid_point ? async_result.get() : direct_result;
 }
 
 template <typename Iterator, typename MatchType>
-Iterator async_find(Iterator first, Iterator last, MatchType match)
+Iterator async_find(thread_pool& pool, Iterator first, Iterator last, MatchType match, unsigned long grain = auto_grain, std::stop_token token = {})
 {
-    std::atomic<bool> done(false);
-    return async_find_impl(first, last, match, done);
+    cancellation_scope scope(token);
+    if (grain == auto_grain)
+    {
+        Iterator const found = find_probe(first, last, match, pool_task_target, grain);
+        if (found != last)
+        {
+            return found;
+        }
+    }
+    std::atomic<unsigned long> best(std::distance(first, last));
+    Iterator const result = pool.in_worker() ? async_find_impl(pool, first, first, last, match, grain, best, scope)
+                                             : pool.submit([&pool, first, last, match, grain, &best, &scope] { return async_find_impl(pool, first, first, last, match, grain, best, scope); }).get();
+    scope.throw_if_cancelled();
+    return result;
 }
 
 int main()
@@ -55,5 +159,14 @@ int main()
     const auto end = std::chrono::steady_clock::now();
     std::cout << "Time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
 
+    thread_pool pool;
+    const auto pool_start = std::chrono::steady_clock::now();
+    std::cout << "Pool target: " << *async_find(pool, v.begin(), v.end(), 100000) << std::endl;
+
+    const auto pool_end = std::chrono::steady_clock::now();
+    thread_pool single_pool(1);
+    std::cout << "Single worker pool target: " << *async_find(single_pool, v.begin(), v.end(), 50000) << std::endl;
+    std::cout << "Pool time: " << std::chrono::duration_cast<std::chrono::microseconds>(pool_end - pool_start).count() << "us" << std::endl;
+
     return 0;
 }
@@ -6,26 +6,104 @@
 #include <numeric>
 #include <iterator>
 #include <algorithm>
+#include <functional>
+#include "thread_pool.h"
+#include "grain_size.h"
+#include "cancellation.h"
 
 template <typename Iterator, typename Func>
-void async_for_each(Iterator first, Iterator last, Func f)
+void async_for_each_impl(Iterator first, Iterator last, Func f, unsigned long grain, cancellation_scope& scope)
 {
-    unsigned long const length = std::distance(first, last);
+    try
+    {
+        unsigned long const length = std::distance(first, last);
+        if (length == 0 || scope.stop_requested())
+        {
+            return;
+        }
+        if (length >= 2 * grain)
+        {
+            Iterator const mid_point = first + length / 2;
+            std::future<void> first_half = std::async(&async_for_each_impl<Iterator, Func>, first, mid_point, f, grain, std::ref(scope));
+            async_for_each_impl(mid_point, last, f, grain, scope);
+            first_half.get();
+            return;
+        }
+        std::for_each(first, last, f);
+    }
+    catch (...)
+    {
+        scope.request_stop();
+        throw;
+    }
+}
+
+template <typename Iterator, typename Func>
+void async_for_each(Iterator first, Iterator last, Func f, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first, last);
 
-    if (length == 0)
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&f](Iterator block_start, Iterator block_end) {
+            std::for_each(block_start, block_end, f);
+            return true;
+        });
+    }
+    async_for_each_impl(first, last, f, grain, scope);
+    scope.throw_if_cancelled();
+}
+
+template <typename Iterator, typename Func>
+void async_for_each_impl(thread_pool& pool, Iterator first, Iterator last, Func f, unsigned long grain, cancellation_scope& scope)
+{
+    try
     {
-        return;
+        unsigned long const length = std::distance(first, last);
+        if (length == 0 || scope.stop_requested())
+        {
+            return;
+        }
+        if (length >= 2 * grain)
+        {
+            Iterator const mid_point = first + length / 2;
+            pool_future<void> first_half = pool.submit([&pool, first, mid_point, f, grain, &scope] { async_for_each_impl(pool, first, mid_point, f, grain, scope); });
+            async_for_each_impl(pool, mid_point, last, f, grain, scope);
+            first_half.get();
+            return;
+        }
+        std::for_each(first, last, f);
     }
-    unsigned long const min_per_thread = 25;
-    if (length >= 2 * min_per_thread)
+    catch (...)
     {
-        Iterator const mid_point = first + length / 2;
-        std::future<void> first_half = std::async(&async_for_each<Iterator, Func>, first, mid_point, f);
-        async_for_each(mid_point, last, f);
-        first_half.get();
-        return;
+        scope.request_stop();
+        throw;
     }
-    std::for_each(first, last, f);
+}
+
+template <typename Iterator, typename Func>
+void async_for_each(thread_pool& pool, Iterator first, Iterator last, Func f, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first, last);
+
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, pool_task_target, [&f](Iterator block_start, Iterator block_end) {
+            std::for_each(block_start, block_end, f);
+            return true;
+        });
+    }
+    if (length >= 2 * grain && !pool.in_worker())
+    {
+        pool.submit([&pool, first, last, f, grain, &scope] { async_for_each_impl(pool, first, last, f, grain, scope); }).get();
+    }
+    else
+    {
+        async_for_each_impl(pool, first, last, f, grain, scope);
+    }
+    scope.throw_if_cancelled();
 }
 
 int main()
@@ -38,5 +116,15 @@ int main()
     const auto end = std::chrono::steady_clock::now();
     std::cout << "Time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
 
+    thread_pool pool;
+    const auto pool_start = std::chrono::steady_clock::now();
+    async_for_each(pool, v.begin(), v.end(), [](int& x) { ++x; });
+
+    const auto pool_end = std::chrono::steady_clock::now();
+    std::cout << "Pool time: " << std::chrono::duration_cast<std::chrono::microseconds>(pool_end - pool_start).count() << "us" << std::endl;
+    thread_pool single_pool(1);
+    async_for_each(single_pool, v.begin(), v.end(), [](int& x) { --x; });
+    std::cout << "Check: " << (v.front() == 1 && v.back() == 100000 ? "ok" : "failed") << std::endl;
+
     return 0;
 }
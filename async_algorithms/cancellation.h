@@ -0,0 +1,84 @@
+#ifndef CANCELLATION_H
+#define CANCELLATION_H
+
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <stop_token>
+
+class operation_cancelled : public std::runtime_error
+{
+public:
+    operation_cancelled() : std::runtime_error("operation cancelled") {}
+};
+
+// One per algorithm call. The caller's token is forwarded into a private source, so chunks poll a single flag and a
+// chunk that throws can stop its siblings without touching the caller's source.
+class cancellation_scope
+{
+private:
+    struct forward_stop
+    {
+        std::stop_source* source;
+
+        void operator()() const noexcept
+        {
+            source->request_stop();
+        }
+    };
+
+    std::stop_token caller;
+    std::stop_source source;
+    std::stop_callback<forward_stop> link;
+
+public:
+    explicit cancellation_scope(std::stop_token token) : caller(std::move(token)), link(caller, forward_stop{&source}) {}
+
+    cancellation_scope(cancellation_scope const&) = delete;
+    cancellation_scope& operator=(cancellation_scope const&) = delete;
+
+    bool stop_requested() const noexcept
+    {
+        return source.stop_requested();
+    }
+
+    void request_stop() noexcept
+    {
+        source.request_stop();
+    }
+
+    // Called once every chunk has finished or given up: a partial result must not escape after the caller asked to stop.
+    void throw_if_cancelled() const
+    {
+        if (caller.stop_requested())
+        {
+            throw operation_cancelled();
+        }
+    }
+};
+
+// Runs body on successive chunks of at most grain elements of [first, first + length), checking for a stop request
+// before each one. An exception from body stops the sibling chunks before it propagates.
+template <typename Iterator, typename Func>
+void run_chunks(cancellation_scope& scope, Iterator first, unsigned long length, unsigned long grain, Func&& body)
+{
+    try
+    {
+        while (length != 0 && !scope.stop_requested())
+        {
+            unsigned long const count = std::min(grain, length);
+            Iterator chunk_end = first;
+            std::advance(chunk_end, count);
+            body(first, chunk_end);
+            first = chunk_end;
+            length -= count;
+        }
+    }
+    catch (...)
+    {
+        scope.request_stop();
+        throw;
+    }
+}
+
+#endif
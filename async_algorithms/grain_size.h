@@ -0,0 +1,41 @@
+#ifndef GRAIN_SIZE_H
+#define GRAIN_SIZE_H
+
+#include <chrono>
+#include <iterator>
+#include <algorithm>
+
+unsigned long const auto_grain = 0;
+
+std::chrono::nanoseconds const thread_task_target = std::chrono::microseconds(200);
+std::chrono::nanoseconds const pool_task_target = std::chrono::microseconds(20);
+
+template <typename Iterator, typename Func>
+unsigned long probe_grain_size(Iterator& first, unsigned long& length, std::chrono::nanoseconds target_task, Func&& process)
+{
+    std::chrono::steady_clock::duration elapsed(0);
+    unsigned long consumed = 0;
+    unsigned long step = 16;
+    while (length != 0 && elapsed < target_task / 4)
+    {
+        unsigned long const count = std::min(step, length);
+        Iterator block_end = first;
+        std::advance(block_end, count);
+        const auto start = std::chrono::steady_clock::now();
+        bool const keep_going = process(first, block_end);
+        elapsed += std::chrono::steady_clock::now() - start;
+        first = block_end;
+        length -= count;
+        consumed += count;
+        step *= 2;
+        if (!keep_going)
+        {
+            length = 0;
+        }
+    }
+    double const elapsed_ns = std::max<double>(1.0, std::chrono::duration<double, std::nano>(elapsed).count());
+    double const grain = target_task.count() * static_cast<double>(consumed) / elapsed_ns;
+    return std::max(1ul, static_cast<unsigned long>(std::min<double>(grain, 1e15)));
+}
+
+#endif
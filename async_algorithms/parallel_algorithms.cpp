@@ -0,0 +1,427 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <utility>
+#include <iterator>
+#include <optional>
+#include <exception>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include "grain_size.h"
+#include "cancellation.h"
+
+class join_threads
+{
+private:
+    std::vector<std::thread>& ts;
+
+public:
+    explicit join_threads(std::vector<std::thread>& _ts) : ts(_ts) {}
+
+    ~join_threads()
+    {
+        for (auto& t : ts)
+        {
+            if (t.joinable())
+            {
+                t.join();
+            }
+        }
+    }
+};
+
+// One block per thread: block i starts at offsets[i], and the last block takes the remainder.
+template <typename Iterator>
+struct block_split
+{
+    std::vector<unsigned long> offsets;
+    std::vector<Iterator> starts;
+
+    block_split(Iterator first, unsigned long length, unsigned long grain)
+    {
+        unsigned long const max_threads = (length + grain - 1) / grain;
+        unsigned long const hardware_threads = std::thread::hardware_concurrency();
+        unsigned long const num_threads = std::min(hardware_threads != 0 ? hardware_threads : 2, max_threads);
+        for (unsigned long i = 0; i < num_threads; ++i)
+        {
+            offsets.push_back(i * (length / num_threads));
+        }
+        offsets.push_back(length);
+        starts = starts_in(first);
+    }
+
+    unsigned long size() const
+    {
+        return offsets.size() - 1;
+    }
+
+    unsigned long length(unsigned long i) const
+    {
+        return offsets[i + 1] - offsets[i];
+    }
+
+    // The matching block starts in a second sequence walked in step with the first, such as an output range.
+    template <typename OtherIterator>
+    std::vector<OtherIterator> starts_in(OtherIterator first) const
+    {
+        std::vector<OtherIterator> res(offsets.size(), first);
+        for (unsigned long i = 1; i < offsets.size(); ++i)
+        {
+            res[i] = res[i - 1];
+            std::advance(res[i], offsets[i] - offsets[i - 1]);
+        }
+        return res;
+    }
+};
+
+// Runs block(i) for every block, the calling thread taking block 0. The first exception is rethrown once every block
+// has returned, and the scope has already asked the others to stop by then.
+template <typename BlockFunc>
+void run_blocks(unsigned long block_count, cancellation_scope& scope, BlockFunc block)
+{
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto run = [&](unsigned long i) {
+        try
+        {
+            block(i);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lk(error_mutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+            scope.request_stop();
+        }
+    };
+    {
+        std::vector<std::thread> ts(block_count - 1);
+        join_threads joiners(ts);
+        for (unsigned long i = 1; i < block_count; ++i)
+        {
+            ts[i - 1] = std::thread(run, i);
+        }
+        run(0);
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    scope.throw_if_cancelled();
+}
+
+template <typename Iterator, typename OutputIterator, typename UnaryOp>
+OutputIterator parallel_transform(Iterator first, Iterator last, OutputIterator d_first, UnaryOp op, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first, last);
+
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&d_first, &op](Iterator block_start, Iterator block_end) {
+            d_first = std::transform(block_start, block_end, d_first, op);
+            return true;
+        });
+    }
+    if (length == 0)
+    {
+        scope.throw_if_cancelled();
+        return d_first;
+    }
+    block_split<Iterator> const blocks(first, length, grain);
+    std::vector<OutputIterator> const d_starts = blocks.starts_in(d_first);
+    run_blocks(blocks.size(), scope, [&](unsigned long i) {
+        OutputIterator out = d_starts[i];
+        run_chunks(scope, blocks.starts[i], blocks.length(i), grain, [&out, &op](Iterator chunk_start, Iterator chunk_end) {
+            out = std::transform(chunk_start, chunk_end, out, op);
+        });
+    });
+    return d_starts.back();
+}
+
+template <typename Iterator, typename Predicate>
+typename std::iterator_traits<Iterator>::difference_type parallel_count_if(Iterator first, Iterator last, Predicate pred, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    using count_type = typename std::iterator_traits<Iterator>::difference_type;
+
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first, last);
+    count_type count = 0;
+
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&count, &pred](Iterator block_start, Iterator block_end) {
+            count += std::count_if(block_start, block_end, pred);
+            return true;
+        });
+    }
+    if (length == 0)
+    {
+        scope.throw_if_cancelled();
+        return count;
+    }
+    block_split<Iterator> const blocks(first, length, grain);
+    std::vector<count_type> counts(blocks.size());
+    run_blocks(blocks.size(), scope, [&](unsigned long i) {
+        count_type block_count = 0;
+        run_chunks(scope, blocks.starts[i], blocks.length(i), grain, [&block_count, &pred](Iterator chunk_start, Iterator chunk_end) {
+            block_count += std::count_if(chunk_start, chunk_end, pred);
+        });
+        counts[i] = block_count;
+    });
+    return std::accumulate(counts.begin(), counts.end(), count);
+}
+
+// Same tie-breaking as std::minmax_element: the first smallest and the last largest element.
+template <typename Iterator, typename Compare>
+requires std::is_invocable_r_v<bool, Compare&, std::iter_reference_t<Iterator>, std::iter_reference_t<Iterator>>
+std::pair<Iterator, Iterator> parallel_minmax_element(Iterator first, Iterator last, Compare comp, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    using minmax_type = std::pair<Iterator, Iterator>;
+
+    // lhs covers elements before rhs, so ties keep lhs's minimum and rhs's maximum.
+    auto merge = [&comp](std::optional<minmax_type> const& lhs, minmax_type const& rhs) {
+        if (!lhs)
+        {
+            return rhs;
+        }
+        return minmax_type(comp(*rhs.first, *lhs->first) ? rhs.first : lhs->first, comp(*rhs.second, *lhs->second) ? lhs->second : rhs.second);
+    };
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first, last);
+    std::optional<minmax_type> result;
+
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&result, &merge, &comp](Iterator block_start, Iterator block_end) {
+            result = merge(result, std::minmax_element(block_start, block_end, comp));
+            return true;
+        });
+    }
+    if (length == 0)
+    {
+        scope.throw_if_cancelled();
+        return result ? *result : minmax_type(last, last);
+    }
+    block_split<Iterator> const blocks(first, length, grain);
+    std::vector<std::optional<minmax_type>> partials(blocks.size());
+    run_blocks(blocks.size(), scope, [&](unsigned long i) {
+        std::optional<minmax_type> partial;
+        run_chunks(scope, blocks.starts[i], blocks.length(i), grain, [&partial, &merge, &comp](Iterator chunk_start, Iterator chunk_end) {
+            partial = merge(partial, std::minmax_element(chunk_start, chunk_end, comp));
+        });
+        partials[i] = partial;
+    });
+    for (auto const& partial : partials)
+    {
+        result = merge(result, *partial);
+    }
+    return *result;
+}
+
+template <typename Iterator>
+std::pair<Iterator, Iterator> parallel_minmax_element(Iterator first, Iterator last, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    return parallel_minmax_element(first, last, std::less<>(), grain, std::move(token));
+}
+
+// Block partials are folded together with op1, so op1 has to be associative as well as the accumulation step.
+template <typename Iterator1, typename Iterator2, typename T, typename BinaryOp1, typename BinaryOp2>
+requires std::is_invocable_v<BinaryOp2&, std::iter_reference_t<Iterator1>, std::iter_reference_t<Iterator2>>
+T parallel_inner_product(Iterator1 first1, Iterator1 last1, Iterator2 first2, T init, BinaryOp1 op1, BinaryOp2 op2, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first1, last1);
+
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first1, length, thread_task_target, [&](Iterator1 block_start, Iterator1 block_end) {
+            for (; block_start != block_end; ++block_start, ++first2)
+            {
+                init = op1(std::move(init), op2(*block_start, *first2));
+            }
+            return true;
+        });
+    }
+    if (length == 0)
+    {
+        scope.throw_if_cancelled();
+        return init;
+    }
+    block_split<Iterator1> const blocks(first1, length, grain);
+    std::vector<Iterator2> const starts2 = blocks.starts_in(first2);
+    std::vector<std::optional<T>> partials(blocks.size());
+    run_blocks(blocks.size(), scope, [&](unsigned long i) {
+        std::optional<T> partial;
+        Iterator2 it2 = starts2[i];
+        run_chunks(scope, blocks.starts[i], blocks.length(i), grain, [&](Iterator1 chunk_start, Iterator1 chunk_end) {
+            for (; chunk_start != chunk_end; ++chunk_start, ++it2)
+            {
+                T term = op2(*chunk_start, *it2);
+                partial = partial ? op1(std::move(*partial), std::move(term)) : std::move(term);
+            }
+        });
+        partials[i] = std::move(partial);
+    });
+    for (auto& partial : partials)
+    {
+        init = op1(std::move(init), std::move(*partial));
+    }
+    return init;
+}
+
+template <typename Iterator1, typename Iterator2, typename T>
+T parallel_inner_product(Iterator1 first1, Iterator1 last1, Iterator2 first2, T init, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    return parallel_inner_product(first1, last1, first2, init, std::plus<>(), std::multiplies<>(), grain, std::move(token));
+}
+
+// A hit stops the sibling blocks through the scope. That is not a caller cancellation, so it is not reported as one.
+template <typename Iterator, typename Predicate>
+bool parallel_any_of(Iterator first, Iterator last, Predicate pred, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first, last);
+    bool probe_found = false;
+
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&probe_found, &pred](Iterator block_start, Iterator block_end) {
+            probe_found = std::any_of(block_start, block_end, pred);
+            return !probe_found;
+        });
+    }
+    if (probe_found || length == 0)
+    {
+        scope.throw_if_cancelled();
+        return probe_found;
+    }
+    block_split<Iterator> const blocks(first, length, grain);
+    std::atomic<bool> found(false);
+    run_blocks(blocks.size(), scope, [&](unsigned long i) {
+        run_chunks(scope, blocks.starts[i], blocks.length(i), grain, [&](Iterator chunk_start, Iterator chunk_end) {
+            if (std::any_of(chunk_start, chunk_end, pred))
+            {
+                found.store(true, std::memory_order_relaxed);
+                scope.request_stop();
+            }
+        });
+    });
+    return found.load(std::memory_order_relaxed);
+}
+
+template <typename Iterator, typename Predicate>
+bool parallel_all_of(Iterator first, Iterator last, Predicate pred, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    return !parallel_any_of(first, last, [&pred](auto&& value) { return !pred(value); }, grain, std::move(token));
+}
+
+template <typename Iterator, typename Predicate>
+bool parallel_none_of(Iterator first, Iterator last, Predicate pred, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    return !parallel_any_of(first, last, pred, grain, std::move(token));
+}
+
+// Stream compaction in two passes. The first records a keep flag per element and counts each block. An exclusive scan
+// of the counts gives every block its own output offset, so the second pass writes without locks and keeps input order.
+template <typename Iterator, typename OutputIterator, typename Predicate>
+OutputIterator parallel_copy_if(Iterator first, Iterator last, OutputIterator d_first, Predicate pred, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first, last);
+
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&d_first, &pred](Iterator block_start, Iterator block_end) {
+            d_first = std::copy_if(block_start, block_end, d_first, pred);
+            return true;
+        });
+    }
+    if (length == 0)
+    {
+        scope.throw_if_cancelled();
+        return d_first;
+    }
+    block_split<Iterator> const blocks(first, length, grain);
+    std::vector<char> keep(length);
+    std::vector<unsigned long> counts(blocks.size());
+    run_blocks(blocks.size(), scope, [&](unsigned long i) {
+        unsigned long block_count = 0;
+        unsigned long flag = blocks.offsets[i];
+        run_chunks(scope, blocks.starts[i], blocks.length(i), grain, [&](Iterator chunk_start, Iterator chunk_end) {
+            for (; chunk_start != chunk_end; ++chunk_start, ++flag)
+            {
+                keep[flag] = pred(*chunk_start) ? 1 : 0;
+                block_count += keep[flag];
+            }
+        });
+        counts[i] = block_count;
+    });
+
+    std::vector<OutputIterator> d_starts(blocks.size() + 1, d_first);
+    for (unsigned long i = 0; i < blocks.size(); ++i)
+    {
+        d_starts[i + 1] = d_starts[i];
+        std::advance(d_starts[i + 1], counts[i]);
+    }
+    run_blocks(blocks.size(), scope, [&](unsigned long i) {
+        OutputIterator out = d_starts[i];
+        unsigned long flag = blocks.offsets[i];
+        run_chunks(scope, blocks.starts[i], blocks.length(i), grain, [&](Iterator chunk_start, Iterator chunk_end) {
+            for (; chunk_start != chunk_end; ++chunk_start, ++flag)
+            {
+                if (keep[flag])
+                {
+                    *out = *chunk_start;
+                    ++out;
+                }
+            }
+        });
+    });
+    return d_starts.back();
+}
+
+int main()
+{
+    std::vector<int> v(10000000);
+    for (std::size_t i = 0; i < v.size(); ++i)
+    {
+        v[i] = static_cast<int>(i * 7919LL % 1000003) - 500000;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<long long> squares(v.size());
+    parallel_transform(v.begin(), v.end(), squares.begin(), [](int x) { return 1LL * x * x; });
+    auto const is_even = [](int x) { return x % 2 == 0; };
+    long long const evens = parallel_count_if(v.begin(), v.end(), is_even);
+    auto const [min_it, max_it] = parallel_minmax_element(v.begin(), v.end());
+    auto const widening_product = [](int x, int y) { return 1LL * x * y; };
+    long long const dot = parallel_inner_product(v.begin(), v.end(), v.begin(), 0LL, std::plus<>(), widening_product);
+    bool const any_big = parallel_any_of(v.begin(), v.end(), [](int x) { return x > 499990; });
+    bool const all_bounded = parallel_all_of(v.begin(), v.end(), [](int x) { return x >= -500000 && x <= 500002; });
+    std::vector<int> positives(v.size());
+    positives.erase(parallel_copy_if(v.begin(), v.end(), positives.begin(), [](int x) { return x > 0; }), positives.end());
+    const auto end = std::chrono::steady_clock::now();
+
+    std::vector<long long> expected_squares(v.size());
+    std::transform(v.begin(), v.end(), expected_squares.begin(), [](int x) { return 1LL * x * x; });
+    auto const expected_minmax = std::minmax_element(v.begin(), v.end());
+    std::vector<int> expected_positives;
+    std::copy_if(v.begin(), v.end(), std::back_inserter(expected_positives), [](int x) { return x > 0; });
+    std::cout << "transform " << (squares == expected_squares ? "ok" : "wrong") << std::endl;
+    std::cout << "count_if " << evens << " (expected " << std::count_if(v.begin(), v.end(), is_even) << ")" << std::endl;
+    std::cout << "minmax at " << min_it - v.begin() << ", " << max_it - v.begin() << " (expected " << expected_minmax.first - v.begin() << ", " << expected_minmax.second - v.begin() << ")" << std::endl;
+    std::cout << "inner_product " << dot << " (expected " << std::inner_product(v.begin(), v.end(), v.begin(), 0LL, std::plus<>(), widening_product) << ")" << std::endl;
+    std::cout << "any_of " << any_big << ", all_of " << all_bounded << std::endl;
+    std::cout << "copy_if " << (positives == expected_positives ? "ok" : "wrong") << ", " << positives.size() << " kept" << std::endl;
+    std::cout << "Time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,591 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <cstddef>
+#include <cstring>
+#include <numeric>
+#include <iterator>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+#define SIMD_INLINE __attribute__((always_inline)) inline
+
+// Vectors only cross always_inline helpers, so the psABI warnings about 32/64-byte vector returns do not apply.
+// The pragma stays active because those warnings fire when templates are instantiated at the end of the translation unit.
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+enum class simd_isa
+{
+    baseline,
+    sse4_2,
+    avx2,
+    avx512f
+};
+
+inline simd_isa detect_simd_isa()
+{
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return simd_isa::avx512f;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return simd_isa::avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return simd_isa::sse4_2;
+    }
+#endif
+    return simd_isa::baseline;
+}
+
+inline simd_isa const simd_level = detect_simd_isa();
+
+enum class simd_compare
+{
+    equal,
+    not_equal,
+    less,
+    less_equal,
+    greater,
+    greater_equal
+};
+
+// item <compare> value as a find_if predicate. Searches that receive one can hand the comparison to simd_find.
+template <typename T>
+struct compare_to
+{
+    simd_compare compare;
+    T value;
+
+    bool operator()(T const& item) const
+    {
+        switch (compare)
+        {
+        case simd_compare::equal:
+            return item == value;
+        case simd_compare::not_equal:
+            return item != value;
+        case simd_compare::less:
+            return item < value;
+        case simd_compare::less_equal:
+            return item <= value;
+        case simd_compare::greater:
+            return item > value;
+        default:
+            return item >= value;
+        }
+    }
+};
+
+template <typename T>
+struct simd_lanes
+{
+    static constexpr bool supported = false;
+};
+
+template <>
+struct simd_lanes<int>
+{
+    static constexpr bool supported = true;
+    typedef int v8 __attribute__((vector_size(8)));
+    typedef int v16 __attribute__((vector_size(16)));
+    typedef int v32 __attribute__((vector_size(32)));
+    typedef int v64 __attribute__((vector_size(64)));
+};
+
+template <>
+struct simd_lanes<long long>
+{
+    static constexpr bool supported = true;
+    typedef long long v8 __attribute__((vector_size(8)));
+    typedef long long v16 __attribute__((vector_size(16)));
+    typedef long long v32 __attribute__((vector_size(32)));
+    typedef long long v64 __attribute__((vector_size(64)));
+};
+
+template <>
+struct simd_lanes<float>
+{
+    static constexpr bool supported = true;
+    typedef float v8 __attribute__((vector_size(8)));
+    typedef float v16 __attribute__((vector_size(16)));
+    typedef float v32 __attribute__((vector_size(32)));
+    typedef float v64 __attribute__((vector_size(64)));
+};
+
+template <>
+struct simd_lanes<double>
+{
+    static constexpr bool supported = true;
+    typedef double v8 __attribute__((vector_size(8)));
+    typedef double v16 __attribute__((vector_size(16)));
+    typedef double v32 __attribute__((vector_size(32)));
+    typedef double v64 __attribute__((vector_size(64)));
+};
+
+template <typename T, std::size_t Bytes>
+using simd_vector = std::conditional_t<Bytes == 8, typename simd_lanes<T>::v8, std::conditional_t<Bytes == 16, typename simd_lanes<T>::v16, std::conditional_t<Bytes == 32, typename simd_lanes<T>::v32, typename simd_lanes<T>::v64>>>;
+
+template <typename T, typename A>
+struct simd_reducible_pair : std::bool_constant<simd_lanes<T>::supported && (std::is_same<T, A>::value || (std::is_same<T, int>::value && std::is_same<A, long long>::value) || (std::is_same<T, float>::value && std::is_same<A, double>::value))>
+{
+};
+
+template <typename Vector>
+SIMD_INLINE Vector simd_load(void const* p)
+{
+    Vector v;
+    std::memcpy(&v, p, sizeof(Vector));
+    return v;
+}
+
+template <typename Mask>
+SIMD_INLINE bool simd_any(Mask const& m)
+{
+    typedef unsigned long long bits16 __attribute__((vector_size(16)));
+    typedef unsigned long long bits32 __attribute__((vector_size(32)));
+    bits16 low;
+    if constexpr (sizeof(Mask) == sizeof(bits16))
+    {
+        std::memcpy(&low, &m, sizeof(low));
+    }
+    else
+    {
+        static_assert(sizeof(Mask) == sizeof(bits32), "simd_any expects a 16 or 32-byte mask");
+        bits32 bits;
+        std::memcpy(&bits, &m, sizeof(bits));
+        low = __builtin_shufflevector(bits, bits, 0, 1) | __builtin_shufflevector(bits, bits, 2, 3);
+    }
+    return (low[0] | low[1]) != 0;
+}
+
+// Source lanes are loaded at the accumulator's lane count, so int -> long long and float -> double widen in register.
+// Four accumulators hide the add latency.
+template <std::size_t Bytes, typename T, typename A>
+SIMD_INLINE A reduce_kernel(T const* data, std::size_t n, A init)
+{
+    using accumulator = simd_vector<A, Bytes>;
+    using source = simd_vector<T, Bytes * sizeof(T) / sizeof(A)>;
+    constexpr std::size_t lanes = sizeof(accumulator) / sizeof(A);
+
+    accumulator acc0 = {}, acc1 = {}, acc2 = {}, acc3 = {};
+    std::size_t i = 0;
+    for (; i + 4 * lanes <= n; i += 4 * lanes)
+    {
+        acc0 += __builtin_convertvector(simd_load<source>(data + i), accumulator);
+        acc1 += __builtin_convertvector(simd_load<source>(data + i + lanes), accumulator);
+        acc2 += __builtin_convertvector(simd_load<source>(data + i + 2 * lanes), accumulator);
+        acc3 += __builtin_convertvector(simd_load<source>(data + i + 3 * lanes), accumulator);
+    }
+    for (; i + lanes <= n; i += lanes)
+    {
+        acc0 += __builtin_convertvector(simd_load<source>(data + i), accumulator);
+    }
+    acc0 += acc1 + acc2 + acc3;
+    A res = init;
+    for (std::size_t lane = 0; lane < lanes; ++lane)
+    {
+        res += acc0[lane];
+    }
+    for (; i < n; ++i)
+    {
+        res += data[i];
+    }
+    return res;
+}
+
+template <simd_compare Compare, typename Lhs, typename Rhs>
+SIMD_INLINE auto simd_test(Lhs const& lhs, Rhs const& rhs)
+{
+    if constexpr (Compare == simd_compare::equal)
+    {
+        return lhs == rhs;
+    }
+    else if constexpr (Compare == simd_compare::not_equal)
+    {
+        return lhs != rhs;
+    }
+    else if constexpr (Compare == simd_compare::less)
+    {
+        return lhs < rhs;
+    }
+    else if constexpr (Compare == simd_compare::less_equal)
+    {
+        return lhs <= rhs;
+    }
+    else if constexpr (Compare == simd_compare::greater)
+    {
+        return lhs > rhs;
+    }
+    else
+    {
+        return lhs >= rhs;
+    }
+}
+
+// Four vectors are tested per iteration with their masks OR-ed, so the branch is taken once per four loads.
+template <std::size_t Bytes, simd_compare Compare, typename T>
+SIMD_INLINE std::size_t find_kernel(T const* data, std::size_t n, T value)
+{
+    using vector = simd_vector<T, Bytes>;
+    constexpr std::size_t lanes = Bytes / sizeof(T);
+
+    std::size_t i = 0;
+    if constexpr (lanes > 1)
+    {
+        vector const needle = vector{} + value;
+        for (; i + 4 * lanes <= n; i += 4 * lanes)
+        {
+            auto const hit = simd_test<Compare>(simd_load<vector>(data + i), needle) | simd_test<Compare>(simd_load<vector>(data + i + lanes), needle) | simd_test<Compare>(simd_load<vector>(data + i + 2 * lanes), needle) | simd_test<Compare>(simd_load<vector>(data + i + 3 * lanes), needle);
+            if (simd_any(hit))
+            {
+                break;
+            }
+        }
+    }
+    for (; i < n; ++i)
+    {
+        if (simd_test<Compare>(data[i], value))
+        {
+            return i;
+        }
+    }
+    return n;
+}
+
+template <std::size_t Bytes, typename T>
+SIMD_INLINE std::size_t find_compare_kernel(T const* data, std::size_t n, simd_compare compare, T value)
+{
+    switch (compare)
+    {
+    case simd_compare::equal:
+        return find_kernel<Bytes, simd_compare::equal>(data, n, value);
+    case simd_compare::not_equal:
+        return find_kernel<Bytes, simd_compare::not_equal>(data, n, value);
+    case simd_compare::less:
+        return find_kernel<Bytes, simd_compare::less>(data, n, value);
+    case simd_compare::less_equal:
+        return find_kernel<Bytes, simd_compare::less_equal>(data, n, value);
+    case simd_compare::greater:
+        return find_kernel<Bytes, simd_compare::greater>(data, n, value);
+    default:
+        return find_kernel<Bytes, simd_compare::greater_equal>(data, n, value);
+    }
+}
+
+// Log-step scan inside one register: shift in zeros by 1, 2, 4, ... lanes and add.
+template <std::size_t Shift, typename Vector, std::size_t... Lane>
+SIMD_INLINE void scan_lanes(Vector& x, std::index_sequence<Lane...> lanes)
+{
+    if constexpr (Shift < sizeof...(Lane))
+    {
+        Vector const zero = {};
+        x += __builtin_shufflevector(zero, x, (Lane < Shift ? Lane : Lane + sizeof...(Lane) - Shift)...);
+        scan_lanes<2 * Shift>(x, lanes);
+    }
+}
+
+template <typename Vector, std::size_t... Lane>
+SIMD_INLINE void broadcast_last(Vector const& x, Vector& carry, std::index_sequence<Lane...>)
+{
+    carry = __builtin_shufflevector(x, x, (Lane * 0 + sizeof...(Lane) - 1)...);
+}
+
+// The carry stays broadcast in a register, so the loop-carried chain is one shuffle and one add per vector.
+// src may equal dst: each vector is loaded before it is stored.
+template <std::size_t Bytes, typename T>
+SIMD_INLINE T scan_kernel(T const* src, T* dst, std::size_t n, T init)
+{
+    using vector = simd_vector<T, Bytes>;
+    constexpr std::size_t lanes = Bytes / sizeof(T);
+
+    vector carry = vector{} + init;
+    std::size_t i = 0;
+    for (; i + lanes <= n; i += lanes)
+    {
+        vector x = simd_load<vector>(src + i);
+        scan_lanes<1>(x, std::make_index_sequence<lanes>());
+        x += carry;
+        std::memcpy(dst + i, &x, sizeof(x));
+        broadcast_last(x, carry, std::make_index_sequence<lanes>());
+    }
+    T res = carry[0];
+    for (; i < n; ++i)
+    {
+        res += src[i];
+        dst[i] = res;
+    }
+    return res;
+}
+
+template <typename T, typename A>
+SIMD_TARGET("avx512f") A reduce_avx512f(T const* data, std::size_t n, A init)
+{
+    return reduce_kernel<64>(data, n, init);
+}
+
+template <typename T, typename A>
+SIMD_TARGET("avx2") A reduce_avx2(T const* data, std::size_t n, A init)
+{
+    return reduce_kernel<32>(data, n, init);
+}
+
+template <typename T, typename A>
+SIMD_TARGET("sse4.2") A reduce_sse4_2(T const* data, std::size_t n, A init)
+{
+    return reduce_kernel<16 * sizeof(A) / sizeof(T)>(data, n, init);
+}
+
+template <typename T, typename A>
+A reduce_baseline(T const* data, std::size_t n, A init)
+{
+    return reduce_kernel<16 * sizeof(A) / sizeof(T)>(data, n, init);
+}
+
+// 64-byte compares are avoided even with AVX-512F: without AVX-512DQ GCC cannot turn the mask register back into lanes.
+template <typename T>
+SIMD_TARGET("avx2") std::size_t find_avx2(T const* data, std::size_t n, simd_compare compare, T value)
+{
+    return find_compare_kernel<32>(data, n, compare, value);
+}
+
+template <typename T>
+SIMD_TARGET("sse4.2") std::size_t find_sse4_2(T const* data, std::size_t n, simd_compare compare, T value)
+{
+    return find_compare_kernel<16>(data, n, compare, value);
+}
+
+// SSE2 has no 64-bit integer compare, so long long stays scalar on the baseline.
+template <typename T>
+std::size_t find_baseline(T const* data, std::size_t n, simd_compare compare, T value)
+{
+    if constexpr (std::is_same<T, long long>::value)
+    {
+        return find_compare_kernel<sizeof(T)>(data, n, compare, value);
+    }
+    else
+    {
+        return find_compare_kernel<16>(data, n, compare, value);
+    }
+}
+
+template <typename T>
+SIMD_TARGET("avx512f") T scan_avx512f(T const* src, T* dst, std::size_t n, T init)
+{
+    return scan_kernel<64>(src, dst, n, init);
+}
+
+template <typename T>
+SIMD_TARGET("avx2") T scan_avx2(T const* src, T* dst, std::size_t n, T init)
+{
+    return scan_kernel<32>(src, dst, n, init);
+}
+
+template <typename T>
+SIMD_TARGET("sse4.2") T scan_sse4_2(T const* src, T* dst, std::size_t n, T init)
+{
+    return scan_kernel<16>(src, dst, n, init);
+}
+
+template <typename T>
+T scan_baseline(T const* src, T* dst, std::size_t n, T init)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        init += src[i];
+        dst[i] = init;
+    }
+    return init;
+}
+
+template <typename T, typename A>
+A simd_reduce(T const* data, std::size_t n, A init)
+{
+    switch (simd_level)
+    {
+    case simd_isa::avx512f:
+        return reduce_avx512f(data, n, init);
+    case simd_isa::avx2:
+        return reduce_avx2(data, n, init);
+    case simd_isa::sse4_2:
+        return reduce_sse4_2(data, n, init);
+    default:
+        return reduce_baseline(data, n, init);
+    }
+}
+
+template <typename T>
+std::size_t simd_find(T const* data, std::size_t n, simd_compare compare, T value)
+{
+    switch (simd_level)
+    {
+    case simd_isa::avx512f:
+    case simd_isa::avx2:
+        return find_avx2(data, n, compare, value);
+    case simd_isa::sse4_2:
+        return find_sse4_2(data, n, compare, value);
+    default:
+        return find_baseline(data, n, compare, value);
+    }
+}
+
+template <typename T>
+T simd_inclusive_scan(T const* src, T* dst, std::size_t n, T init)
+{
+    switch (simd_level)
+    {
+    case simd_isa::avx512f:
+        return scan_avx512f(src, dst, n, init);
+    case simd_isa::avx2:
+        return scan_avx2(src, dst, n, init);
+    case simd_isa::sse4_2:
+        return scan_sse4_2(src, dst, n, init);
+    default:
+        return scan_baseline(src, dst, n, init);
+    }
+}
+
+template <typename Iterator>
+using simd_value_t = std::remove_cv_t<std::iter_value_t<Iterator>>;
+
+template <typename Iterator, typename T>
+constexpr bool simd_reducible = std::contiguous_iterator<Iterator> && simd_reducible_pair<simd_value_t<Iterator>, T>::value;
+
+template <typename Iterator, typename MatchType>
+constexpr bool simd_searchable = std::contiguous_iterator<Iterator> && simd_lanes<simd_value_t<Iterator>>::supported && std::is_same<simd_value_t<Iterator>, MatchType>::value;
+
+template <typename Iterator, typename OutputIterator, typename T>
+constexpr bool simd_scannable = std::contiguous_iterator<Iterator> && std::contiguous_iterator<OutputIterator> && !std::is_const<std::remove_reference_t<std::iter_reference_t<OutputIterator>>>::value && std::is_same<simd_value_t<Iterator>, T>::value && std::is_same<simd_value_t<OutputIterator>, T>::value && (std::is_same<T, int>::value || std::is_same<T, long long>::value);
+
+template <typename Iterator, typename T>
+T block_reduce(Iterator first, Iterator last, T init)
+{
+    if constexpr (simd_reducible<Iterator, T>)
+    {
+        return simd_reduce(std::to_address(first), static_cast<std::size_t>(last - first), init);
+    }
+    else
+    {
+        return std::accumulate(first, last, init);
+    }
+}
+
+template <typename Iterator, typename MatchType>
+Iterator block_find(Iterator first, Iterator last, MatchType const& match)
+{
+    if constexpr (simd_searchable<Iterator, MatchType>)
+    {
+        return first + simd_find(std::to_address(first), static_cast<std::size_t>(last - first), simd_compare::equal, match);
+    }
+    else
+    {
+        return std::find(first, last, match);
+    }
+}
+
+unsigned long const find_block_size = 4096;
+
+// Searches find_block_size elements at a time so a shared done flag is polled between blocks rather than per element.
+template <typename Iterator, typename MatchType, typename Stop>
+Iterator block_find(Iterator first, Iterator last, MatchType const& match, Stop&& stop)
+{
+    if constexpr (simd_searchable<Iterator, MatchType>)
+    {
+        while (first != last && !stop())
+        {
+            Iterator const block_end = first + std::min<std::iter_difference_t<Iterator>>(find_block_size, last - first);
+            Iterator const it = block_find(first, block_end, match);
+            if (it != block_end)
+            {
+                return it;
+            }
+            first = block_end;
+        }
+    }
+    else
+    {
+        for (; first != last && !stop(); ++first)
+        {
+            if (*first == match)
+            {
+                return first;
+            }
+        }
+    }
+    return last;
+}
+
+template <typename Iterator>
+Iterator block_find_compare(Iterator first, Iterator last, simd_compare compare, simd_value_t<Iterator> value)
+{
+    if constexpr (std::contiguous_iterator<Iterator> && simd_lanes<simd_value_t<Iterator>>::supported)
+    {
+        return first + simd_find(std::to_address(first), static_cast<std::size_t>(last - first), compare, value);
+    }
+    else
+    {
+        return std::find_if(first, last, compare_to<simd_value_t<Iterator>>{compare, value});
+    }
+}
+
+template <typename Iterator, typename Stop>
+Iterator block_find_compare(Iterator first, Iterator last, simd_compare compare, simd_value_t<Iterator> value, Stop&& stop)
+{
+    if constexpr (std::contiguous_iterator<Iterator> && simd_lanes<simd_value_t<Iterator>>::supported)
+    {
+        while (first != last && !stop())
+        {
+            Iterator const block_end = first + std::min<std::iter_difference_t<Iterator>>(find_block_size, last - first);
+            Iterator const it = block_find_compare(first, block_end, compare, value);
+            if (it != block_end)
+            {
+                return it;
+            }
+            first = block_end;
+        }
+    }
+    else
+    {
+        compare_to<simd_value_t<Iterator>> const pred{compare, value};
+        for (; first != last && !stop(); ++first)
+        {
+            if (pred(*first))
+            {
+                return first;
+            }
+        }
+    }
+    return last;
+}
+
+// Writes init + x0, init + x0 + x1, ... to d_first and returns the last value written (init for an empty range).
+template <typename Iterator, typename OutputIterator, typename T>
+T block_inclusive_scan(Iterator first, Iterator last, OutputIterator d_first, T init)
+{
+    if constexpr (simd_scannable<Iterator, OutputIterator, T>)
+    {
+        return simd_inclusive_scan(std::to_address(first), std::to_address(d_first), static_cast<std::size_t>(last - first), init);
+    }
+    else
+    {
+        for (; first != last; ++first, ++d_first)
+        {
+            init = init + *first;
+            *d_first = init;
+        }
+        return init;
+    }
+}
+
+#endif
@@ -5,6 +5,12 @@
 #include <chrono>
 #include <numeric>
 #include <iterator>
+#include <optional>
+#include <functional>
+#include <type_traits>
+#include "grain_size.h"
+#include "simd_kernels.h"
+#include "cancellation.h"
 
 class join_threads
 {
@@ -26,31 +32,63 @@ public:
     }
 };
 
-template <typename Iterator, typename T>
+// Chunks are never empty, so seeding the partial with the first element lets any associative op work without an
+// identity. The partial stays empty if the block is cancelled before its first chunk.
+template <typename Iterator, typename T, typename BinaryOp = std::plus<T>>
 struct accumulate_block
 {
-    T operator()(Iterator first, Iterator last)
+    BinaryOp op;
+
+    std::optional<T> operator()(Iterator first, unsigned long length, unsigned long grain, cancellation_scope& scope)
     {
-        return std::accumulate(first, last, T());
+        std::optional<T> partial;
+        run_chunks(scope, first, length, grain, [this, &partial](Iterator chunk_start, Iterator chunk_end) {
+            if constexpr (std::is_same<BinaryOp, std::plus<T>>::value)
+            {
+                partial = block_reduce(chunk_start, chunk_end, partial ? *partial : T());
+            }
+            else
+            {
+                T init = partial ? op(std::move(*partial), *chunk_start) : T(*chunk_start);
+                partial = std::accumulate(std::next(chunk_start), chunk_end, std::move(init), op);
+            }
+        });
+        return partial;
     }
 };
 
-template <typename Iterator, typename T>
-T thread_accumulate(Iterator first, Iterator last, T init)
+template <typename Iterator, typename T, typename BinaryOp>
+requires std::is_invocable_r_v<T, BinaryOp&, T, T>
+T thread_accumulate(Iterator first, Iterator last, T init, BinaryOp op, unsigned long grain = auto_grain, std::stop_token token = {})
 {
-    unsigned long const length = std::distance(first, last);
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first, last);
 
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&init, &op](Iterator block_start, Iterator block_end) {
+            if constexpr (std::is_same<BinaryOp, std::plus<T>>::value)
+            {
+                init = block_reduce(block_start, block_end, init);
+            }
+            else
+            {
+                init = std::accumulate(block_start, block_end, std::move(init), op);
+            }
+            return true;
+        });
+    }
     if (length == 0)
     {
+        scope.throw_if_cancelled();
         return init;
     }
-    unsigned long const min_per_thread = 25;
-    unsigned long const max_threads = (length + min_per_thread - 1) / min_per_thread;
+    unsigned long const max_threads = (length + grain - 1) / grain;
     unsigned long const hardware_threads = std::thread::hardware_concurrency();
     unsigned long const num_threads = std::min(hardware_threads != 0 ? hardware_threads : 2, max_threads);
     unsigned long const block_size = length / num_threads;
 
-    std::vector<std::future<T>> fs(num_threads - 1);
+    std::vector<std::future<std::optional<T>>> fs(num_threads - 1);
     std::vector<std::thread> ts(num_threads - 1);
     join_threads joiners(ts);
     Iterator block_start = first;
@@ -58,19 +96,61 @@ T thread_accumulate(Iterator first, Iterator last, T init)
     {
         Iterator block_end = block_start;
         std::advance(block_end, block_size);
-        std::packaged_task<T(Iterator, Iterator)> task((accumulate_block<Iterator, T>()));
+        std::packaged_task<std::optional<T>(Iterator)> task([op, block_size, grain, &scope](Iterator start) {
+            return accumulate_block<Iterator, T, BinaryOp>{op}(start, block_size, grain, scope);
+        });
         fs[i] = task.get_future();
-        ts[i] = std::thread(std::move(task), block_start, block_end);
+        ts[i] = std::thread(std::move(task), block_start);
         block_start = block_end;
     }
-    T last_result = accumulate_block<Iterator, T>()(block_start, last);
-    T result = init;
+    std::optional<T> last_result = accumulate_block<Iterator, T, BinaryOp>{op}(block_start, length - (num_threads - 1) * block_size, grain, scope);
+    T result = std::move(init);
     for (unsigned long i = 0; i < num_threads - 1; ++i)
     {
-        result += fs[i].get();
+        if (std::optional<T> partial = fs[i].get())
+        {
+            result = op(std::move(result), std::move(*partial));
+        }
     }
-    result += last_result;
-    return result;
+    scope.throw_if_cancelled();
+    return op(std::move(result), std::move(*last_result));
+}
+
+template <typename Iterator, typename T>
+T thread_accumulate(Iterator first, Iterator last, T init, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    return thread_accumulate(first, last, init, std::plus<T>(), grain, std::move(token));
+}
+
+// Whole numbers keep every float sum exact, so each ISA's reduction must equal std::accumulate however the lanes were
+// added, for the widening int -> long long and float -> double pairs as well as the plain ones.
+template <typename T, typename A>
+bool check_simd_reduce()
+{
+    std::vector<T> data(1031);
+    for (std::size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<T>(static_cast<long long>(i * 37 % 101) - 50);
+    }
+    bool correct = true;
+    for (std::size_t n : {std::size_t(0), std::size_t(1), std::size_t(7), std::size_t(33), std::size_t(130), data.size()})
+    {
+        A const expected = std::accumulate(data.data(), data.data() + n, A(3));
+        correct = correct && reduce_baseline(data.data(), n, A(3)) == expected;
+        if (simd_level >= simd_isa::sse4_2)
+        {
+            correct = correct && reduce_sse4_2(data.data(), n, A(3)) == expected;
+        }
+        if (simd_level >= simd_isa::avx2)
+        {
+            correct = correct && reduce_avx2(data.data(), n, A(3)) == expected;
+        }
+        if (simd_level >= simd_isa::avx512f)
+        {
+            correct = correct && reduce_avx512f(data.data(), n, A(3)) == expected;
+        }
+    }
+    return correct;
 }
 
 int main()
@@ -79,6 +159,10 @@ int main()
     std::vector<int> v(10000000);
     std::iota(v.begin(), v.end(), 1);
     std::cout << "Sum: " << thread_accumulate(v.begin(), v.end(), 0LL) << std::endl;
+    std::cout << "Max: " << thread_accumulate(v.begin(), v.end(), 0, [](int x, int y) { return std::max(x, y); }) << std::endl;
+
+    bool const simd_matches = check_simd_reduce<int, int>() && check_simd_reduce<int, long long>() && check_simd_reduce<long long, long long>() && check_simd_reduce<float, float>() && check_simd_reduce<float, double>() && check_simd_reduce<double, double>();
+    std::cout << "simd_reduce against scalar: " << (simd_matches ? "ok" : "wrong") << std::endl;
 
     const auto end = std::chrono::steady_clock::now();
     std::cout << "Time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
@@ -1,10 +1,19 @@
 #include <iostream>
 #include <vector>
+#include <list>
 #include <thread>
-#include <future>
 #include <chrono>
 #include <numeric>
 #include <iterator>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <functional>
+#include <type_traits>
+#include "grain_size.h"
+#include "simd_kernels.h"
+#include "cancellation.h"
 
 class join_threads
 {
@@ -26,71 +35,224 @@ public:
     }
 };
 
-template <typename Iterator, typename MatchType>
-Iterator thread_find(Iterator first, Iterator last, MatchType match)
+inline void fetch_min(std::atomic<unsigned long>& best, unsigned long value)
+{
+    unsigned long current = best.load();
+    while (value < current && !best.compare_exchange_weak(current, value))
+    {
+    }
+}
+
+template <typename Iterator, typename Predicate, typename Stop>
+Iterator find_if_until(Iterator first, Iterator last, Predicate& pred, Stop&& stop)
 {
-    struct find_element
+    for (unsigned long checked = 0; first != last; ++first, ++checked)
     {
-        void operator()(Iterator begin, Iterator end, MatchType match, std::promise<Iterator>* result, std::atomic<bool>* done_flag)
+        if (checked == find_block_size)
         {
-            try
+            if (stop())
             {
-                while (begin != end && !done_flag->load())
-                {
-                    if (*begin == match)
-                    {
-                        result->set_value(begin);
-                        done_flag->store(true);
-                        return;
-                    }
-                    ++begin;
-                }
+                return last;
             }
-            catch (...)
+            checked = 0;
+        }
+        if (pred(*first))
+        {
+            return first;
+        }
+    }
+    return last;
+}
+
+// Returns the lowest-index hit of search(block_start, block_end, stop). Threads claim grain-sized blocks in index order,
+// so a hit in block b lets every block after b be skipped, and a block already being searched gives up once stop()
+// reports a hit before its start or a cancellation.
+template <typename Iterator, typename BlockSearch>
+Iterator parallel_find_blocks(Iterator first, Iterator last, unsigned long grain, std::stop_token token, BlockSearch search)
+{
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first, last);
+
+    if (grain == auto_grain)
+    {
+        Iterator found = last;
+        grain = probe_grain_size(first, length, thread_task_target, [&found, &search](Iterator block_start, Iterator block_end) {
+            Iterator const it = search(block_start, block_end, [] { return false; });
+            if (it != block_end)
             {
-                try
-                {
-                    result->set_exception(std::current_exception());
-                    done_flag->store(true);
-                }
-                catch (...)
-                {
-                }
+                found = it;
+                return false;
             }
+            return true;
+        });
+        if (found != last)
+        {
+            return found;
         }
-    };
-    unsigned long const length = std::distance(first, last);
-
+    }
     if (length == 0)
     {
+        scope.throw_if_cancelled();
         return last;
     }
-    unsigned long const min_per_thread = 25;
-    unsigned long const max_threads = (length + min_per_thread - 1) / min_per_thread;
+    unsigned long const block_count = (length + grain - 1) / grain;
     unsigned long const hardware_threads = std::thread::hardware_concurrency();
-    unsigned long const num_threads = std::min(hardware_threads != 0 ? hardware_threads : 2, max_threads);
-    unsigned long const block_size = length / num_threads;
+    unsigned long const num_threads = std::min(hardware_threads != 0 ? hardware_threads : 2, block_count);
 
-    std::promise<Iterator> result;
-    std::atomic<bool> done_flag(false);
-    std::vector<std::thread> ts(num_threads - 1);
+    // Random access iterators reach any block in constant time; others are walked to every block start up front.
+    constexpr bool random_access = std::random_access_iterator<Iterator>;
+    std::vector<Iterator> block_starts;
+    if constexpr (!random_access)
     {
+        block_starts.assign(block_count + 1, first);
+        for (unsigned long i = 1; i < block_count; ++i)
+        {
+            block_starts[i] = block_starts[i - 1];
+            std::advance(block_starts[i], grain);
+        }
+        block_starts[block_count] = last;
+    }
+    auto const block_start = [&](unsigned long block) {
+        if constexpr (random_access)
+        {
+            return block == block_count ? last : first + static_cast<std::iter_difference_t<Iterator>>(block * grain);
+        }
+        else
+        {
+            return block_starts[block];
+        }
+    };
+
+    std::atomic<unsigned long> best(length);
+    std::atomic<unsigned long> next_block(0);
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto find_blocks = [&]() {
+        try
+        {
+            for (;;)
+            {
+                unsigned long const block = next_block.fetch_add(1, std::memory_order_relaxed);
+                unsigned long const offset = block * grain;
+                if (block >= block_count || offset >= best.load(std::memory_order_relaxed) || scope.stop_requested())
+                {
+                    return;
+                }
+                Iterator const block_begin = block_start(block);
+                Iterator const block_end = block_start(block + 1);
+                Iterator const it = search(block_begin, block_end, [&best, &scope, offset] { return best.load(std::memory_order_relaxed) < offset || scope.stop_requested(); });
+                if (it != block_end)
+                {
+                    fetch_min(best, offset + std::distance(block_begin, it));
+                    return;
+                }
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lk(error_mutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+            scope.request_stop();
+        }
+    };
+    {
+        std::vector<std::thread> ts(num_threads - 1);
         join_threads joiner(ts);
-        Iterator block_start = first;
-        for (unsigned long i = 0; i < num_threads - 1; ++i)
+        for (auto& t : ts)
         {
-            Iterator block_end = block_start;
-            std::advance(block_end, block_size);
-            ts[i] = std::thread(find_element(), block_start, block_end, match, &result, &done_flag);
-            block_start = block_end;
+            t = std::thread(find_blocks);
         }
-        find_element()(block_start, last, match, &result, &done_flag);
+        find_blocks();
     }
-    if (!done_flag.load())
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    scope.throw_if_cancelled();
+    unsigned long const found = best.load();
+    if (found == length)
     {
         return last;
     }
-    return result.get_future().get();
+    Iterator result = block_start(found / grain);
+    std::advance(result, found % grain);
+    return result;
+}
+
+template <typename Iterator, typename MatchType>
+Iterator thread_find(Iterator first, Iterator last, MatchType match, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    return parallel_find_blocks(first, last, grain, std::move(token), [&match](Iterator block_start, Iterator block_end, auto&& stop) {
+        return block_find(block_start, block_end, match, stop);
+    });
+}
+
+// A compare_to predicate is searched with simd_find; any other predicate is called element by element.
+template <typename Iterator, typename Predicate>
+Iterator parallel_find_if(Iterator first, Iterator last, Predicate pred, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    return parallel_find_blocks(first, last, grain, std::move(token), [&pred](Iterator block_start, Iterator block_end, auto&& stop) {
+        if constexpr (std::is_same<Predicate, compare_to<simd_value_t<Iterator>>>::value)
+        {
+            return block_find_compare(block_start, block_end, pred.compare, pred.value, stop);
+        }
+        else
+        {
+            return find_if_until(block_start, block_end, pred, stop);
+        }
+    });
+}
+
+template <typename Iterator, typename ForwardIterator, typename BinaryPredicate>
+    requires std::is_invocable_r_v<bool, BinaryPredicate&, std::iter_reference_t<Iterator>, std::iter_reference_t<ForwardIterator>>
+Iterator parallel_find_first_of(Iterator first, Iterator last, ForwardIterator s_first, ForwardIterator s_last, BinaryPredicate pred, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    return parallel_find_if(first, last, [s_first, s_last, &pred](auto const& value) {
+        return std::any_of(s_first, s_last, [&value, &pred](auto const& candidate) { return pred(value, candidate); });
+    }, grain, std::move(token));
+}
+
+template <typename Iterator, typename ForwardIterator>
+Iterator parallel_find_first_of(Iterator first, Iterator last, ForwardIterator s_first, ForwardIterator s_last, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    return parallel_find_first_of(first, last, s_first, s_last, std::equal_to<>(), grain, std::move(token));
+}
+
+// Every compare on every ISA this CPU runs must stop at the same index as the scalar predicate, including hits that
+// land in the scalar tail after the last full vector.
+template <typename T>
+bool check_simd_find()
+{
+    std::vector<T> data(1031);
+    for (std::size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<T>(static_cast<long long>(i * 37 % 101) - 50);
+    }
+    simd_compare const compares[] = {simd_compare::equal, simd_compare::not_equal, simd_compare::less, simd_compare::less_equal, simd_compare::greater, simd_compare::greater_equal};
+    bool correct = true;
+    for (std::size_t n : {std::size_t(0), std::size_t(1), std::size_t(7), std::size_t(33), std::size_t(130), data.size()})
+    {
+        for (simd_compare compare : compares)
+        {
+            for (T value : {T(-60), T(-50), T(0), T(49), T(50)})
+            {
+                std::size_t const expected = std::find_if(data.data(), data.data() + n, compare_to<T>{compare, value}) - data.data();
+                correct = correct && find_baseline(data.data(), n, compare, value) == expected;
+                if (simd_level >= simd_isa::sse4_2)
+                {
+                    correct = correct && find_sse4_2(data.data(), n, compare, value) == expected;
+                }
+                if (simd_level >= simd_isa::avx2)
+                {
+                    correct = correct && find_avx2(data.data(), n, compare, value) == expected;
+                }
+            }
+        }
+    }
+    return correct;
 }
 
 int main()
@@ -100,6 +262,23 @@ int main()
     std::iota(v.begin(), v.end(), 1);
     std::cout << "Target: " << *thread_find(v.begin(), v.end(), 1000000) << std::endl;
 
+    std::vector<int> w(v.size());
+    for (std::size_t i = 0; i < w.size(); ++i)
+    {
+        w[i] = static_cast<int>(i * 7919LL % 1000003);
+    }
+    auto const is_big = [](int x) { return x > 1000000; };
+    std::vector<int> const needles{999999, 1000001, 1000002};
+    std::cout << "First > 1000000 at " << parallel_find_if(w.begin(), w.end(), is_big) - w.begin() << " (expected " << std::find_if(w.begin(), w.end(), is_big) - w.begin() << ")" << std::endl;
+    std::cout << "First > 1000000 with simd_find at " << parallel_find_if(w.begin(), w.end(), compare_to<int>{simd_compare::greater, 1000000}) - w.begin() << std::endl;
+    std::list<int> const l(w.begin(), w.begin() + 200000);
+    auto const is_near_top = [](int x) { return x > 999000; };
+    std::cout << "List first > 999000 at " << std::distance(l.begin(), parallel_find_if(l.begin(), l.end(), is_near_top, 1000)) << " (expected " << std::distance(l.begin(), std::find_if(l.begin(), l.end(), is_near_top)) << ")" << std::endl;
+    std::cout << "First of needles at " << parallel_find_first_of(w.begin(), w.end(), needles.begin(), needles.end(), 1000) - w.begin() << " (expected " << std::find_first_of(w.begin(), w.end(), needles.begin(), needles.end()) - w.begin() << ")" << std::endl;
+
+    bool const simd_matches = check_simd_find<int>() && check_simd_find<long long>() && check_simd_find<float>() && check_simd_find<double>();
+    std::cout << "simd_find against scalar: " << (simd_matches ? "ok" : "wrong") << std::endl;
+
     const auto end = std::chrono::steady_clock::now();
     std::cout << "Time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
 
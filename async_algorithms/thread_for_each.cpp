@@ -1,11 +1,17 @@
 #include <iostream>
 #include <vector>
+#include <list>
 #include <thread>
-#include <future>
+#include <mutex>
+#include <atomic>
 #include <chrono>
 #include <numeric>
 #include <iterator>
+#include <exception>
 #include <algorithm>
+#include <type_traits>
+#include "grain_size.h"
+#include "cancellation.h"
 
 class join_threads
 {
@@ -27,41 +33,313 @@ public:
     }
 };
 
+enum class schedule_mode
+{
+    static_blocks,
+    dynamic,
+    guided
+};
+
+// static_blocks: one equal block per thread. dynamic: grain-sized chunks. guided: each chunk is a 1 / (2 * num_threads)
+// share of what is left, never below grain, so chunks shrink as the range drains. Chunks are worked out as they are
+// claimed, so nothing proportional to the number of chunks is stored.
+class chunk_cursor
+{
+private:
+    unsigned long const length;
+    unsigned long const grain;
+    unsigned long const num_threads;
+    schedule_mode const mode;
+    std::atomic<unsigned long> next;
+
+public:
+    chunk_cursor(unsigned long _length, unsigned long _grain, unsigned long _num_threads, schedule_mode _mode)
+        : length(_length), grain(_grain), num_threads(_num_threads), mode(_mode), next(0)
+    {
+    }
+
+    void static_block(unsigned long id, unsigned long& offset, unsigned long& count) const
+    {
+        unsigned long const block_size = length / num_threads;
+        offset = id * block_size;
+        count = id + 1 == num_threads ? length - offset : block_size;
+    }
+
+    // Claims the next dynamic or guided chunk; false once the range is used up.
+    bool claim(unsigned long& offset, unsigned long& count)
+    {
+        if (mode == schedule_mode::dynamic)
+        {
+            unsigned long const k = next.fetch_add(1, std::memory_order_relaxed);
+            if (k >= (length + grain - 1) / grain)
+            {
+                return false;
+            }
+            offset = k * grain;
+            count = std::min(grain, length - offset);
+            return true;
+        }
+        unsigned long cur = next.load(std::memory_order_relaxed);
+        do
+        {
+            if (cur >= length)
+            {
+                return false;
+            }
+            count = std::min(length - cur, std::max(grain, (length - cur) / (2 * num_threads)));
+        } while (!next.compare_exchange_weak(cur, cur + count, std::memory_order_relaxed));
+        offset = cur;
+        return true;
+    }
+};
+
+// Chunk offsets plus length, for iterators that have to be walked to each chunk start up front.
+inline std::vector<unsigned long> schedule_bounds(unsigned long length, unsigned long grain, unsigned long num_threads, schedule_mode mode)
+{
+    std::vector<unsigned long> bounds;
+    chunk_cursor chunks(length, grain, num_threads, mode);
+    unsigned long offset = 0, count = 0;
+    if (mode == schedule_mode::static_blocks)
+    {
+        for (unsigned long i = 0; i < num_threads; ++i)
+        {
+            chunks.static_block(i, offset, count);
+            bounds.push_back(offset);
+        }
+    }
+    else
+    {
+        while (chunks.claim(offset, count))
+        {
+            bounds.push_back(offset);
+        }
+    }
+    bounds.push_back(length);
+    return bounds;
+}
+
+// Runs worker(id) on num_threads threads, the calling one included. The first exception stops the other workers and is
+// rethrown once they have all finished.
+template <typename Worker>
+void run_workers(unsigned long num_threads, cancellation_scope& scope, Worker worker)
+{
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto guarded = [&](unsigned long id) {
+        try
+        {
+            worker(id);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lk(error_mutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+            scope.request_stop();
+        }
+    };
+    {
+        std::vector<std::thread> ts(num_threads - 1);
+        join_threads joiners(ts);
+        for (unsigned long i = 1; i < num_threads; ++i)
+        {
+            ts[i - 1] = std::thread(guarded, i);
+        }
+        guarded(0);
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    scope.throw_if_cancelled();
+}
+
+// Runs chunk(k) for every chunk of a precomputed schedule. Static blocks are pinned to thread k; otherwise threads keep
+// claiming the next chunk from a shared cursor, so a slow chunk only delays its own thread.
+template <typename ChunkFunc>
+void run_schedule(unsigned long chunk_count, unsigned long num_threads, schedule_mode mode, cancellation_scope& scope, ChunkFunc chunk)
+{
+    std::atomic<unsigned long> cursor(0);
+    run_workers(num_threads, scope, [&](unsigned long id) {
+        if (mode == schedule_mode::static_blocks)
+        {
+            chunk(id);
+            return;
+        }
+        for (unsigned long k = cursor.fetch_add(1, std::memory_order_relaxed); k < chunk_count && !scope.stop_requested(); k = cursor.fetch_add(1, std::memory_order_relaxed))
+        {
+            chunk(k);
+        }
+    });
+}
+
+inline unsigned long schedule_threads(unsigned long length, unsigned long grain)
+{
+    unsigned long const max_threads = (length + grain - 1) / grain;
+    unsigned long const hardware_threads = std::thread::hardware_concurrency();
+    return std::min(hardware_threads != 0 ? hardware_threads : 2, max_threads);
+}
+
 template <typename Iterator, typename Func>
-void thread_for_each(Iterator first, Iterator last, Func f)
+void thread_for_each(Iterator first, Iterator last, Func f, schedule_mode mode, unsigned long grain = auto_grain, std::stop_token token = {})
 {
-    unsigned long const length = std::distance(first, last);
+    cancellation_scope scope(token);
+    unsigned long length = std::distance(first, last);
 
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&f](Iterator block_start, Iterator block_end) {
+            std::for_each(block_start, block_end, f);
+            return true;
+        });
+    }
     if (length == 0)
     {
+        scope.throw_if_cancelled();
         return;
     }
-    unsigned long const min_per_thread = 25;
-    unsigned long const max_threads = (length + min_per_thread - 1) / min_per_thread;
-    unsigned long const hardware_threads = std::thread::hardware_concurrency();
-    unsigned long const num_threads = std::min(hardware_threads != 0 ? hardware_threads : 2, max_threads);
-    unsigned long const block_size = length / num_threads;
+    unsigned long const num_threads = schedule_threads(length, grain);
+    auto for_each_chunk = [&f](Iterator chunk_start, Iterator chunk_end) { std::for_each(chunk_start, chunk_end, f); };
 
-    std::vector<std::future<void>> fs(num_threads - 1);
-    std::vector<std::thread> ts(num_threads - 1);
-    join_threads joiners(ts);
-    Iterator block_start = first;
-    for (unsigned long i = 0; i < num_threads - 1; ++i)
+    // Random access iterators jump straight to each claimed chunk, as parallel_for does with indices. Other iterators
+    // are walked to every chunk start before the threads begin.
+    if constexpr (std::random_access_iterator<Iterator>)
     {
-        Iterator block_end = block_start;
-        std::advance(block_end, block_size);
-        std::packaged_task<void(void)> task([=]() { std::for_each(block_start, block_end, f); });
-        fs[i] = task.get_future();
-        ts[i] = std::thread(std::move(task));
-        block_start = block_end;
+        chunk_cursor chunks(length, grain, num_threads, mode);
+        auto run_range = [&](unsigned long offset, unsigned long count) {
+            run_chunks(scope, first + static_cast<std::iter_difference_t<Iterator>>(offset), count, grain, for_each_chunk);
+        };
+        run_workers(num_threads, scope, [&](unsigned long id) {
+            unsigned long offset = 0, count = 0;
+            if (mode == schedule_mode::static_blocks)
+            {
+                chunks.static_block(id, offset, count);
+                run_range(offset, count);
+                return;
+            }
+            while (!scope.stop_requested() && chunks.claim(offset, count))
+            {
+                run_range(offset, count);
+            }
+        });
     }
-    std::for_each(block_start, last, f);
-    for (auto& t : fs)
+    else
     {
-        t.get();
+        std::vector<unsigned long> const bounds = schedule_bounds(length, grain, num_threads, mode);
+        std::vector<Iterator> starts(bounds.size() - 1, first);
+        for (unsigned long k = 1; k < starts.size(); ++k)
+        {
+            starts[k] = starts[k - 1];
+            std::advance(starts[k], bounds[k] - bounds[k - 1]);
+        }
+        run_schedule(starts.size(), num_threads, mode, scope, [&](unsigned long k) {
+            run_chunks(scope, starts[k], bounds[k + 1] - bounds[k], grain, for_each_chunk);
+        });
     }
 }
 
+template <typename Iterator, typename Func>
+void thread_for_each(Iterator first, Iterator last, Func f, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    thread_for_each(first, last, f, schedule_mode::static_blocks, grain, std::move(token));
+}
+
+// Just enough of a random access iterator for probe_grain_size to walk an index range.
+template <typename Index>
+struct index_iterator
+{
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = Index;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Index const*;
+    using reference = Index;
+
+    Index value;
+
+    Index operator*() const
+    {
+        return value;
+    }
+
+    index_iterator& operator++()
+    {
+        ++value;
+        return *this;
+    }
+
+    index_iterator& operator--()
+    {
+        --value;
+        return *this;
+    }
+
+    index_iterator& operator+=(difference_type n)
+    {
+        value = static_cast<Index>(value + n);
+        return *this;
+    }
+};
+
+// Calls f(i) for every i in [begin, end). Indices need no iterator to walk, so any chunk is reached in constant time.
+template <typename Index, typename Func>
+requires std::is_integral_v<Index>
+void parallel_for(Index begin, Index end, unsigned long grain, Func f, schedule_mode mode = schedule_mode::dynamic, std::stop_token token = {})
+{
+    cancellation_scope scope(token);
+    if (!(begin < end))
+    {
+        scope.throw_if_cancelled();
+        return;
+    }
+    unsigned long length = static_cast<unsigned long>(end - begin);
+
+    if (grain == auto_grain)
+    {
+        index_iterator<Index> first{begin};
+        grain = probe_grain_size(first, length, thread_task_target, [&f](index_iterator<Index> block_start, index_iterator<Index> block_end) {
+            for (Index i = *block_start; i != *block_end; ++i)
+            {
+                f(i);
+            }
+            return true;
+        });
+        begin = *first;
+    }
+    if (length == 0)
+    {
+        scope.throw_if_cancelled();
+        return;
+    }
+    unsigned long const num_threads = schedule_threads(length, grain);
+    chunk_cursor chunks(length, grain, num_threads, mode);
+    auto run_range = [&](unsigned long first_offset, unsigned long count) {
+        Index const chunk_begin = static_cast<Index>(begin + first_offset);
+        for (unsigned long offset = 0; offset < count && !scope.stop_requested(); offset += grain)
+        {
+            Index const chunk_end = static_cast<Index>(chunk_begin + std::min(count, offset + grain));
+            for (Index i = static_cast<Index>(chunk_begin + offset); i != chunk_end; ++i)
+            {
+                f(i);
+            }
+        }
+    };
+    run_workers(num_threads, scope, [&](unsigned long id) {
+        unsigned long offset = 0, count = 0;
+        if (mode == schedule_mode::static_blocks)
+        {
+            chunks.static_block(id, offset, count);
+            run_range(offset, count);
+            return;
+        }
+        while (!scope.stop_requested() && chunks.claim(offset, count))
+        {
+            run_range(offset, count);
+        }
+    });
+}
+
 int main()
 {
     const auto start = std::chrono::steady_clock::now();
@@ -69,8 +347,67 @@ int main()
     std::iota(v.begin(), v.end(), 0);
     thread_for_each(v.begin(), v.end(), [](int& x) { ++x; });
 
+    std::stop_source source;
+    std::atomic<unsigned long> visited(0);
+    try
+    {
+        thread_for_each(v.begin(), v.end(), [&](int&) {
+            if (visited.fetch_add(1) == 1000)
+            {
+                source.request_stop();
+            }
+        }, 10000, source.get_token());
+    }
+    catch (operation_cancelled const& e)
+    {
+        std::cout << e.what() << " after " << visited.load() << " of " << v.size() << " elements" << std::endl;
+    }
+
     const auto end = std::chrono::steady_clock::now();
     std::cout << "Time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
 
+    // Element i costs O(i), so the last static block carries most of the work.
+    std::vector<double> skewed(20000);
+    auto const skewed_work = [](double& x) {
+        std::size_t const n = static_cast<std::size_t>(x);
+        double acc = 0;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            acc += 1.0 / (1.0 + static_cast<double>(i));
+        }
+        x = acc;
+    };
+    std::vector<double> expected(skewed.size());
+    std::iota(expected.begin(), expected.end(), 0.0);
+    std::for_each(expected.begin(), expected.end(), skewed_work);
+    char const* const names[] = {"static", "dynamic", "guided"};
+    for (schedule_mode mode : {schedule_mode::static_blocks, schedule_mode::dynamic, schedule_mode::guided})
+    {
+        std::iota(skewed.begin(), skewed.end(), 0.0);
+        const auto mode_start = std::chrono::steady_clock::now();
+        thread_for_each(skewed.begin(), skewed.end(), skewed_work, mode, 64);
+        const auto mode_end = std::chrono::steady_clock::now();
+        std::cout << names[static_cast<int>(mode)] << " schedule: " << std::chrono::duration_cast<std::chrono::microseconds>(mode_end - mode_start).count() << "us, "
+                  << (skewed == expected ? "ok" : "wrong") << std::endl;
+
+        std::list<double> skewed_list(skewed.size());
+        std::iota(skewed_list.begin(), skewed_list.end(), 0.0);
+        thread_for_each(skewed_list.begin(), skewed_list.end(), skewed_work, mode, 64);
+        std::cout << names[static_cast<int>(mode)] << " schedule on a list: " << (std::equal(skewed_list.begin(), skewed_list.end(), expected.begin()) ? "ok" : "wrong") << std::endl;
+    }
+
+    std::vector<long long> squares(1000001);
+    for (schedule_mode mode : {schedule_mode::static_blocks, schedule_mode::dynamic, schedule_mode::guided})
+    {
+        std::fill(squares.begin(), squares.end(), -1);
+        parallel_for(0, static_cast<int>(squares.size()), 4096, [&squares](int i) { squares[i] = 1LL * i * i; }, mode);
+        bool correct = true;
+        for (std::size_t i = 0; i < squares.size(); ++i)
+        {
+            correct = correct && squares[i] == static_cast<long long>(i * i);
+        }
+        std::cout << "parallel_for " << names[static_cast<int>(mode)] << " squares " << (correct ? "ok" : "wrong") << std::endl;
+    }
+
     return 0;
 }
@@ -1,11 +1,21 @@
 #include <iostream>
 #include <vector>
 #include <thread>
-#include <future>
+#include <mutex>
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <numeric>
+#include <utility>
 #include <iterator>
+#include <optional>
+#include <exception>
 #include <algorithm>
+#include <functional>
+#include <type_traits>
+#include "grain_size.h"
+#include "simd_kernels.h"
+#include "cancellation.h"
 
 class join_threads
 {
@@ -27,78 +37,408 @@ public:
     }
 };
 
-template <typename Iterator>
-void thread_partial_sum(Iterator first, Iterator last)
+template <typename S>
+struct alignas(64) tile_status
+{
+    static constexpr int invalid = 0;
+    static constexpr int aggregate_ready = 1;
+    static constexpr int prefix_ready = 2;
+    static constexpr int failed = 3;
+
+    std::atomic<int> flag{invalid};
+    std::optional<S> aggregate;
+    std::optional<S> inclusive_prefix;
+
+    void publish(int state)
+    {
+        flag.store(state, std::memory_order_release);
+        flag.notify_all();
+    }
+
+    int wait_published() const
+    {
+        int state = flag.load(std::memory_order_acquire);
+        while (state == invalid)
+        {
+            flag.wait(invalid, std::memory_order_acquire);
+            state = flag.load(std::memory_order_acquire);
+        }
+        return state;
+    }
+};
+
+struct scan_aborted
 {
-    using value_type = typename Iterator::value_type;
+};
 
-    struct process_chunk
+// Single-pass scan with decoupled look-back. Tiles are claimed in order. Each tile publishes its aggregate, then walks
+// back over its predecessors until it meets an inclusive prefix, publishes its own prefix and only then scans.
+// tile_reduce(t) returns the tile's aggregate; tile_scan(t, exclusive) writes the output and returns the inclusive prefix.
+template <typename S, typename Combine, typename TileReduce, typename TileScan>
+void lookback_scan(unsigned long tile_count, std::optional<S> const& carry, Combine combine, TileReduce tile_reduce, TileScan tile_scan, std::stop_token token)
+{
+    cancellation_scope scope(token);
+    unsigned long const hardware_threads = std::thread::hardware_concurrency();
+    unsigned long const num_threads = std::min(hardware_threads != 0 ? hardware_threads : 2, tile_count);
+    if (num_threads == 1)
     {
-        void operator()(Iterator begin, Iterator last, std::future<value_type>* previous_end_value, std::promise<value_type>* end_value)
+        std::optional<S> prefix(carry);
+        for (unsigned long t = 0; t < tile_count && !scope.stop_requested(); ++t)
+        {
+            prefix.emplace(tile_scan(t, prefix ? &*prefix : nullptr));
+        }
+        scope.throw_if_cancelled();
+        return;
+    }
+
+    std::unique_ptr<tile_status<S>[]> status(new tile_status<S>[tile_count]);
+    std::atomic<unsigned long> next_tile(0);
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    auto process_tile = [&](unsigned long t) {
+        if (t == 0)
+        {
+            status[0].inclusive_prefix.emplace(tile_scan(0, carry ? &*carry : nullptr));
+            status[0].publish(tile_status<S>::prefix_ready);
+            return;
+        }
+        S const aggregate = tile_reduce(t);
+        status[t].aggregate.emplace(aggregate);
+        status[t].publish(tile_status<S>::aggregate_ready);
+
+        std::optional<S> exclusive;
+        for (unsigned long j = t - 1;; --j)
+        {
+            int const state = status[j].wait_published();
+            if (state == tile_status<S>::failed)
+            {
+                throw scan_aborted();
+            }
+            S const& predecessor = state == tile_status<S>::prefix_ready ? *status[j].inclusive_prefix : *status[j].aggregate;
+            exclusive.emplace(exclusive ? combine(predecessor, *exclusive) : predecessor);
+            if (state == tile_status<S>::prefix_ready)
+            {
+                break;
+            }
+        }
+        status[t].inclusive_prefix.emplace(combine(*exclusive, aggregate));
+        status[t].publish(tile_status<S>::prefix_ready);
+        tile_scan(t, &*exclusive);
+    };
+    // Successors blocked in look-back on a failed tile give up instead of waiting for a prefix that never comes.
+    // Cancellation only stops new tiles from being claimed, and every claimed tile either finishes or fails.
+    auto abandon_tile = [&](unsigned long t) {
+        if (status[t].flag.load(std::memory_order_relaxed) != tile_status<S>::prefix_ready)
+        {
+            status[t].publish(tile_status<S>::failed);
+        }
+        scope.request_stop();
+    };
+    auto worker = [&]() {
+        while (!scope.stop_requested())
         {
+            unsigned long const t = next_tile.fetch_add(1, std::memory_order_relaxed);
+            if (t >= tile_count)
+            {
+                return;
+            }
             try
             {
-                Iterator end = last;
-                ++end;
-                std::partial_sum(begin, end, begin);
-                if (previous_end_value)
-                {
-                    value_type addend = previous_end_value->get();
-                    *last += addend;
-                    if (end_value)
-                    {
-                        end_value->set_value(*last);
-                    }
-                    std::for_each(begin, last, [addend](value_type& item) { item += addend; });
-                }
-                else if (end_value)
-                {
-                    end_value->set_value(*last);
-                }
+                process_tile(t);
+            }
+            catch (scan_aborted const&)
+            {
+                abandon_tile(t);
             }
             catch (...)
             {
-                if (end_value)
                 {
-                    end_value->set_exception(std::current_exception());
-                }
-                else
-                {
-                    throw;
+                    std::lock_guard<std::mutex> lk(error_mutex);
+                    if (!error)
+                    {
+                        error = std::current_exception();
+                    }
                 }
+                abandon_tile(t);
             }
         }
     };
-    unsigned long const length = std::distance(first, last);
 
+    {
+        std::vector<std::thread> ts(num_threads - 1);
+        join_threads joiners(ts);
+        for (unsigned long i = 0; i < num_threads - 1; ++i)
+        {
+            ts[i] = std::thread(worker);
+        }
+        worker();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    scope.throw_if_cancelled();
+}
+
+// Tiles are read twice (reduce, then scan), so they are capped to stay cache resident between the two passes.
+unsigned long const scan_tile_bytes = 256 * 1024;
+
+template <typename Iterator, typename OutputIterator>
+struct scan_tiles
+{
+    std::vector<Iterator> starts;
+    std::vector<OutputIterator> d_starts;
+
+    scan_tiles(Iterator first, OutputIterator d_first, unsigned long length, unsigned long grain)
+    {
+        using value_type = typename std::iterator_traits<Iterator>::value_type;
+        grain = std::min(grain, std::max(1ul, static_cast<unsigned long>(scan_tile_bytes / sizeof(value_type))));
+        unsigned long const tile_count = (length + grain - 1) / grain;
+        starts.reserve(tile_count + 1);
+        d_starts.reserve(tile_count);
+        for (unsigned long i = 0; i < tile_count; ++i)
+        {
+            starts.push_back(first);
+            d_starts.push_back(d_first);
+            unsigned long const count = std::min(grain, length - i * grain);
+            std::advance(first, count);
+            std::advance(d_first, count);
+        }
+        starts.push_back(first);
+    }
+
+    unsigned long size() const
+    {
+        return d_starts.size();
+    }
+
+    OutputIterator d_end() const
+    {
+        OutputIterator res = d_starts.back();
+        std::advance(res, std::distance(starts[size() - 1], starts[size()]));
+        return res;
+    }
+};
+
+// The running value is combined left to right, so op only has to be associative.
+template <typename Iterator, typename OutputIterator, typename T, typename BinaryOp>
+T inclusive_scan_block(Iterator first, Iterator last, OutputIterator d_first, T const* prefix, BinaryOp& op)
+{
+    if constexpr (std::is_same<BinaryOp, std::plus<T>>::value)
+    {
+        return block_inclusive_scan(first, last, d_first, prefix ? *prefix : T());
+    }
+    else
+    {
+        T acc = prefix ? op(*prefix, *first) : T(*first);
+        *d_first = acc;
+        for (++first, ++d_first; first != last; ++first, ++d_first)
+        {
+            acc = op(std::move(acc), *first);
+            *d_first = acc;
+        }
+        return acc;
+    }
+}
+
+template <typename Iterator, typename T, typename BinaryOp>
+T reduce_block(Iterator first, Iterator last, BinaryOp& op)
+{
+    if constexpr (std::is_same<BinaryOp, std::plus<T>>::value)
+    {
+        return block_reduce(first, last, T());
+    }
+    else
+    {
+        T acc = *first;
+        for (++first; first != last; ++first)
+        {
+            acc = op(std::move(acc), *first);
+        }
+        return acc;
+    }
+}
+
+template <typename Iterator, typename OutputIterator, typename BinaryOp>
+requires std::is_invocable_v<BinaryOp&, typename std::iterator_traits<Iterator>::value_type, typename std::iterator_traits<Iterator>::value_type>
+OutputIterator thread_inclusive_scan(Iterator first, Iterator last, OutputIterator d_first, BinaryOp op, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    using value_type = typename std::iterator_traits<Iterator>::value_type;
+
+    unsigned long length = std::distance(first, last);
+    std::optional<value_type> carry;
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&carry, &d_first, &op](Iterator block_start, Iterator block_end) {
+            carry.emplace(inclusive_scan_block(block_start, block_end, d_first, carry ? &*carry : nullptr, op));
+            std::advance(d_first, std::distance(block_start, block_end));
+            return true;
+        });
+    }
     if (length == 0)
     {
-        return;
+        return d_first;
     }
-    unsigned long const min_per_thread = 25;
-    unsigned long const max_threads = (length + min_per_thread - 1) / min_per_thread;
-    unsigned long const hardware_threads = std::thread::hardware_concurrency();
-    unsigned long const num_threads = std::min(hardware_threads != 0 ? hardware_threads : 2, max_threads);
-    unsigned long const block_size = length / num_threads;
-
-    std::vector<std::thread> ts(num_threads - 1);
-    std::vector<std::promise<value_type>> end_values(num_threads - 1);
-    std::vector<std::future<value_type>> previous_end_values;
-    previous_end_values.reserve(num_threads - 1);
-    join_threads joiners(ts);
-    Iterator block_start = first;
-    for (unsigned long i = 0; i < num_threads - 1; ++i)
-    {
-        Iterator block_last = block_start;
-        std::advance(block_last, block_size - 1);
-        ts[i] = std::thread(process_chunk(), block_start, block_last, i != 0 ? &previous_end_values[i - 1] : nullptr, &end_values[i]);
-        block_start = block_last;
-        ++block_start;
-        previous_end_values.push_back(end_values[i].get_future());
-    }
-    Iterator final_element = block_start;
-    std::advance(final_element, std::distance(block_start, last) - 1);
-    process_chunk()(block_start, final_element, (num_threads > 1) ? &previous_end_values.back() : nullptr, nullptr);
+    scan_tiles<Iterator, OutputIterator> const tiles(first, d_first, length, grain);
+    lookback_scan<value_type>(
+        tiles.size(), carry, op,
+        [&](unsigned long t) { return reduce_block<Iterator, value_type>(tiles.starts[t], tiles.starts[t + 1], op); },
+        [&](unsigned long t, value_type const* prefix) { return inclusive_scan_block(tiles.starts[t], tiles.starts[t + 1], tiles.d_starts[t], prefix, op); }, std::move(token));
+    return tiles.d_end();
+}
+
+template <typename Iterator, typename OutputIterator>
+OutputIterator thread_inclusive_scan(Iterator first, Iterator last, OutputIterator d_first, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    return thread_inclusive_scan(first, last, d_first, std::plus<typename std::iterator_traits<Iterator>::value_type>(), grain, std::move(token));
+}
+
+template <typename Iterator, typename OutputIterator, typename T, typename BinaryOp>
+OutputIterator thread_exclusive_scan(Iterator first, Iterator last, OutputIterator d_first, T init, BinaryOp op, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    // Each input element is read before its output slot is written, so first == d_first is allowed.
+    auto exclusive_scan_block = [&op](Iterator block_start, Iterator block_end, OutputIterator out, T acc) {
+        for (; block_start != block_end; ++block_start, ++out)
+        {
+            T next = op(acc, *block_start);
+            *out = std::move(acc);
+            acc = std::move(next);
+        }
+        return acc;
+    };
+    unsigned long length = std::distance(first, last);
+    std::optional<T> carry(std::move(init));
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&carry, &d_first, &exclusive_scan_block](Iterator block_start, Iterator block_end) {
+            carry.emplace(exclusive_scan_block(block_start, block_end, d_first, *carry));
+            std::advance(d_first, std::distance(block_start, block_end));
+            return true;
+        });
+    }
+    if (length == 0)
+    {
+        return d_first;
+    }
+    scan_tiles<Iterator, OutputIterator> const tiles(first, d_first, length, grain);
+    lookback_scan<T>(
+        tiles.size(), carry, op,
+        [&](unsigned long t) { return reduce_block<Iterator, T>(tiles.starts[t], tiles.starts[t + 1], op); },
+        [&](unsigned long t, T const* prefix) { return exclusive_scan_block(tiles.starts[t], tiles.starts[t + 1], tiles.d_starts[t], *prefix); }, std::move(token));
+    return tiles.d_end();
+}
+
+// A set head flag starts a new segment: the scan restarts at that element instead of carrying the running value in.
+// Segments are folded with the associative operator (head, value) . (head', value') = head' ? (head', value') : (head, value op value').
+template <typename Iterator, typename FlagIterator, typename OutputIterator, typename BinaryOp>
+OutputIterator thread_segmented_inclusive_scan(Iterator first, Iterator last, FlagIterator heads, OutputIterator d_first, BinaryOp op, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    using value_type = typename std::iterator_traits<Iterator>::value_type;
+    using segment_state = std::pair<bool, value_type>;
+
+    auto combine = [&op](segment_state const& lhs, segment_state const& rhs) {
+        return rhs.first ? rhs : segment_state(lhs.first, op(lhs.second, rhs.second));
+    };
+    auto fold_block = [&op](Iterator block_start, Iterator block_end, FlagIterator head, segment_state const* prefix, auto&& emit) {
+        segment_state acc(*head, value_type(*block_start));
+        if (!*head && prefix)
+        {
+            acc = segment_state(prefix->first, op(prefix->second, *block_start));
+        }
+        emit(acc.second);
+        for (++block_start, ++head; block_start != block_end; ++block_start, ++head)
+        {
+            if (*head)
+            {
+                acc = segment_state(true, *block_start);
+            }
+            else
+            {
+                acc.second = op(std::move(acc.second), *block_start);
+            }
+            emit(acc.second);
+        }
+        return acc;
+    };
+    unsigned long length = std::distance(first, last);
+    std::optional<segment_state> carry;
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&](Iterator block_start, Iterator block_end) {
+            carry.emplace(fold_block(block_start, block_end, heads, carry ? &*carry : nullptr, [&d_first](value_type const& value) {
+                *d_first = value;
+                ++d_first;
+            }));
+            std::advance(heads, std::distance(block_start, block_end));
+            return true;
+        });
+    }
+    if (length == 0)
+    {
+        return d_first;
+    }
+    scan_tiles<Iterator, OutputIterator> const tiles(first, d_first, length, grain);
+    std::vector<FlagIterator> head_starts;
+    head_starts.reserve(tiles.size());
+    for (unsigned long t = 0; t < tiles.size(); ++t)
+    {
+        head_starts.push_back(heads);
+        std::advance(heads, std::distance(tiles.starts[t], tiles.starts[t + 1]));
+    }
+    lookback_scan<segment_state>(
+        tiles.size(), carry, combine,
+        [&](unsigned long t) { return fold_block(tiles.starts[t], tiles.starts[t + 1], head_starts[t], nullptr, [](value_type const&) {}); },
+        [&](unsigned long t, segment_state const* prefix) {
+            OutputIterator out = tiles.d_starts[t];
+            return fold_block(tiles.starts[t], tiles.starts[t + 1], head_starts[t], prefix, [&out](value_type const& value) {
+                *out = value;
+                ++out;
+            });
+        },
+        std::move(token));
+    return tiles.d_end();
+}
+
+template <typename Iterator>
+void thread_partial_sum(Iterator first, Iterator last, unsigned long grain = auto_grain, std::stop_token token = {})
+{
+    thread_inclusive_scan(first, last, first, grain, std::move(token));
+}
+
+// Each ISA's scan must write the same prefix sums as the scalar loop, in place as well as into a separate buffer.
+template <typename T>
+bool check_simd_scan()
+{
+    std::vector<T> data(1031);
+    for (std::size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<T>(static_cast<long long>(i * 37 % 101) - 50);
+    }
+    std::vector<T> expected(data.size()), output(data.size());
+    bool correct = true;
+    for (std::size_t n : {std::size_t(0), std::size_t(1), std::size_t(7), std::size_t(33), std::size_t(130), data.size()})
+    {
+        T const expected_last = scan_baseline(data.data(), expected.data(), n, T(3));
+        auto const matches = [&](T last) {
+            return last == expected_last && std::equal(output.begin(), output.begin() + n, expected.begin());
+        };
+        if (simd_level >= simd_isa::sse4_2)
+        {
+            correct = correct && matches(scan_sse4_2(data.data(), output.data(), n, T(3)));
+        }
+        if (simd_level >= simd_isa::avx2)
+        {
+            correct = correct && matches(scan_avx2(data.data(), output.data(), n, T(3)));
+        }
+        if (simd_level >= simd_isa::avx512f)
+        {
+            correct = correct && matches(scan_avx512f(data.data(), output.data(), n, T(3)));
+        }
+        std::copy(data.begin(), data.begin() + n, output.begin());
+        correct = correct && matches(simd_inclusive_scan(output.data(), output.data(), n, T(3)));
+    }
+    return correct;
 }
 
 int main()
@@ -112,5 +452,36 @@ int main()
     const auto end = std::chrono::steady_clock::now();
     std::cout << "Time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
 
+    std::vector<int> input(1000000);
+    for (std::size_t i = 0; i < input.size(); ++i)
+    {
+        input[i] = static_cast<int>(i * 7919 % 1001) - 500;
+    }
+    std::vector<int> output(input.size()), expected(input.size());
+    thread_exclusive_scan(input.begin(), input.end(), output.begin(), 10, std::plus<int>(), 4096);
+    std::exclusive_scan(input.begin(), input.end(), expected.begin(), 10);
+    bool const exclusive_ok = output == expected;
+
+    auto const max_op = [](int x, int y) { return std::max(x, y); };
+    thread_inclusive_scan(input.begin(), input.end(), output.begin(), max_op, 4096);
+    std::inclusive_scan(input.begin(), input.end(), expected.begin(), max_op);
+    bool const max_ok = output == expected;
+
+    std::vector<char> heads(input.size());
+    for (std::size_t i = 0; i < heads.size(); ++i)
+    {
+        heads[i] = i % 1000 == 0 || i % 7777 == 3;
+    }
+    thread_segmented_inclusive_scan(input.begin(), input.end(), heads.begin(), output.begin(), std::plus<int>(), 4096);
+    int running = 0;
+    bool segmented_ok = true;
+    for (std::size_t i = 0; i < input.size(); ++i)
+    {
+        running = heads[i] ? input[i] : running + input[i];
+        segmented_ok = segmented_ok && output[i] == running;
+    }
+    std::cout << "exclusive scan " << (exclusive_ok ? "ok" : "wrong") << ", max scan " << (max_ok ? "ok" : "wrong") << ", segmented scan " << (segmented_ok ? "ok" : "wrong") << std::endl;
+    std::cout << "simd scan against scalar: " << (check_simd_scan<int>() && check_simd_scan<long long>() ? "ok" : "wrong") << std::endl;
+
     return 0;
 }
@@ -0,0 +1,491 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <future>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <algorithm>
+#include <type_traits>
+
+class join_threads
+{
+private:
+    std::vector<std::thread>& ts;
+
+public:
+    explicit join_threads(std::vector<std::thread>& _ts) : ts(_ts) {}
+
+    ~join_threads()
+    {
+        for (auto& t : ts)
+        {
+            if (t.joinable())
+            {
+                t.join();
+            }
+        }
+    }
+};
+
+class eventcount
+{
+private:
+    std::atomic<unsigned int> epoch;
+    std::atomic<unsigned int> waiters;
+
+public:
+    eventcount() : epoch(0), waiters(0) {}
+
+    eventcount(eventcount const& other) = delete;
+
+    eventcount& operator=(eventcount const& other) = delete;
+
+    unsigned int prepare_wait()
+    {
+        waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_acquire);
+    }
+
+    void cancel_wait()
+    {
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void commit_wait(unsigned int key)
+    {
+        epoch.wait(key, std::memory_order_acquire);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify_one()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) != 0)
+        {
+            epoch.fetch_add(1, std::memory_order_release);
+            epoch.notify_one();
+        }
+    }
+
+    void notify_all()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) != 0)
+        {
+            epoch.fetch_add(1, std::memory_order_release);
+            epoch.notify_all();
+        }
+    }
+};
+
+template <typename T>
+class work_stealing_deque
+{
+    static_assert(std::is_trivially_copyable<T>::value, "work_stealing_deque stores T in atomic slots");
+
+private:
+    struct ring_buffer
+    {
+        std::int64_t const capacity;
+        std::int64_t const mask;
+        std::unique_ptr<std::atomic<T>[]> slots;
+
+        explicit ring_buffer(std::int64_t _capacity) : capacity(_capacity), mask(_capacity - 1), slots(new std::atomic<T>[_capacity]) {}
+
+        T get(std::int64_t i) const
+        {
+            return slots[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(std::int64_t i, T value)
+        {
+            slots[i & mask].store(value, std::memory_order_relaxed);
+        }
+
+        ring_buffer* grow(std::int64_t bottom, std::int64_t top) const
+        {
+            ring_buffer* const res = new ring_buffer(capacity * 2);
+            for (std::int64_t i = top; i != bottom; ++i)
+            {
+                res->put(i, get(i));
+            }
+            return res;
+        }
+    };
+    alignas(64) std::atomic<std::int64_t> top;
+    alignas(64) std::atomic<std::int64_t> bottom;
+    std::atomic<ring_buffer*> buffer;
+    std::vector<std::unique_ptr<ring_buffer>> retired;
+
+public:
+    explicit work_stealing_deque(std::int64_t initial_capacity = 64) : top(0), bottom(0)
+    {
+        std::int64_t capacity = 1;
+        while (capacity < initial_capacity)
+        {
+            capacity <<= 1;
+        }
+        buffer.store(new ring_buffer(capacity), std::memory_order_relaxed);
+    }
+
+    work_stealing_deque(work_stealing_deque const& other) = delete;
+
+    work_stealing_deque& operator=(work_stealing_deque const& other) = delete;
+
+    ~work_stealing_deque()
+    {
+        delete buffer.load(std::memory_order_relaxed);
+    }
+
+    void push(T value)
+    {
+        std::int64_t const b = bottom.load(std::memory_order_relaxed);
+        std::int64_t const t = top.load(std::memory_order_acquire);
+        ring_buffer* a = buffer.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1)
+        {
+            std::unique_ptr<ring_buffer> grown(a->grow(b, t));
+            retired.emplace_back(a);
+            a = grown.release();
+            buffer.store(a, std::memory_order_release);
+        }
+        a->put(b, value);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    std::optional<T> pop()
+    {
+        std::int64_t const b = bottom.load(std::memory_order_relaxed) - 1;
+        ring_buffer* const a = buffer.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        T value = a->get(b);
+        if (t == b)
+        {
+            bool const won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            if (!won)
+            {
+                return std::nullopt;
+            }
+        }
+        return value;
+    }
+
+    std::optional<T> steal()
+    {
+        std::int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t const b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+            return std::nullopt;
+        }
+        ring_buffer* const a = buffer.load(std::memory_order_acquire);
+        T value = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    bool empty() const
+    {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
+};
+
+template <typename T>
+class pool_future;
+
+class thread_pool
+{
+private:
+    struct task_base
+    {
+        virtual void run() = 0;
+        virtual ~task_base() {}
+    };
+
+    template <typename Func>
+    struct task : task_base
+    {
+        Func f;
+        explicit task(Func&& _f) : f(std::move(_f)) {}
+        void run() override { f(); }
+    };
+
+    using local_queue_type = work_stealing_deque<task_base*>;
+
+    std::atomic<bool> done;
+    std::mutex global_mutex;
+    std::queue<task_base*> global_queue;
+    std::atomic<std::size_t> global_count;
+    std::vector<std::unique_ptr<local_queue_type>> local_queues;
+    eventcount work_event;
+    std::vector<std::thread> threads;
+    join_threads joiner;
+
+    inline static thread_local thread_pool* current_pool = nullptr;
+    inline static thread_local unsigned int current_index = 0;
+
+    local_queue_type* local_queue() const
+    {
+        return current_pool == this ? local_queues[current_index].get() : nullptr;
+    }
+
+    void enqueue(task_base* t)
+    {
+        if (local_queue_type* const local = local_queue())
+        {
+            local->push(t);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lk(global_mutex);
+            global_queue.push(t);
+            global_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        work_event.notify_one();
+    }
+
+    task_base* pop_global()
+    {
+        if (global_count.load(std::memory_order_relaxed) == 0)
+        {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lk(global_mutex);
+        if (global_queue.empty())
+        {
+            return nullptr;
+        }
+        task_base* const t = global_queue.front();
+        global_queue.pop();
+        global_count.fetch_sub(1, std::memory_order_relaxed);
+        return t;
+    }
+
+    task_base* find_task()
+    {
+        local_queue_type* const local = local_queue();
+        if (local)
+        {
+            if (std::optional<task_base*> t = local->pop())
+            {
+                return *t;
+            }
+        }
+        if (task_base* const t = pop_global())
+        {
+            return t;
+        }
+        std::size_t const start = local ? current_index + 1 : 0;
+        for (std::size_t i = 0; i < local_queues.size(); ++i)
+        {
+            std::size_t const victim = (start + i) % local_queues.size();
+            if (std::optional<task_base*> t = local_queues[victim]->steal())
+            {
+                return *t;
+            }
+        }
+        return nullptr;
+    }
+
+    static void run_task(task_base* t)
+    {
+        std::unique_ptr<task_base> owned(t);
+        owned->run();
+    }
+
+    void worker_thread(unsigned int index)
+    {
+        current_pool = this;
+        current_index = index;
+        while (!done.load(std::memory_order_acquire))
+        {
+            if (task_base* const t = find_task())
+            {
+                run_task(t);
+                continue;
+            }
+            unsigned int const key = work_event.prepare_wait();
+            if (task_base* const t = find_task())
+            {
+                work_event.cancel_wait();
+                run_task(t);
+            }
+            else if (done.load(std::memory_order_acquire))
+            {
+                work_event.cancel_wait();
+            }
+            else
+            {
+                work_event.commit_wait(key);
+            }
+        }
+    }
+
+public:
+    explicit thread_pool(unsigned int thread_count = std::max(1u, std::thread::hardware_concurrency())) : done(false), global_count(0), joiner(threads)
+    {
+        thread_count = std::max(1u, thread_count);
+        for (unsigned int i = 0; i < thread_count; ++i)
+        {
+            local_queues.emplace_back(new local_queue_type);
+        }
+        try
+        {
+            for (unsigned int i = 0; i < thread_count; ++i)
+            {
+                threads.emplace_back(&thread_pool::worker_thread, this, i);
+            }
+        }
+        catch (...)
+        {
+            done.store(true, std::memory_order_release);
+            work_event.notify_all();
+            throw;
+        }
+    }
+
+    thread_pool(thread_pool const& other) = delete;
+
+    thread_pool& operator=(thread_pool const& other) = delete;
+
+    ~thread_pool()
+    {
+        done.store(true, std::memory_order_release);
+        work_event.notify_all();
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+        while (task_base* const t = pop_global())
+        {
+            delete t;
+        }
+        for (auto& q : local_queues)
+        {
+            while (std::optional<task_base*> t = q->pop())
+            {
+                delete *t;
+            }
+        }
+    }
+
+    std::size_t size() const
+    {
+        return threads.size();
+    }
+
+    bool in_worker() const
+    {
+        return current_pool == this;
+    }
+
+    template <typename Func>
+    pool_future<std::invoke_result_t<Func>> submit(Func f)
+    {
+        using result_type = std::invoke_result_t<Func>;
+        std::packaged_task<result_type()> pt(std::move(f));
+        pool_future<result_type> res(*this, pt.get_future());
+        enqueue(new task<std::packaged_task<result_type()>>(std::move(pt)));
+        return res;
+    }
+
+    bool run_pending_task()
+    {
+        if (task_base* const t = find_task())
+        {
+            run_task(t);
+            return true;
+        }
+        return false;
+    }
+};
+
+template <typename T>
+class pool_future
+{
+private:
+    thread_pool* pool;
+    std::future<T> fut;
+
+public:
+    pool_future() : pool(nullptr) {}
+
+    pool_future(thread_pool& _pool, std::future<T>&& _fut) : pool(&_pool), fut(std::move(_fut)) {}
+
+    pool_future(pool_future&& other) = default;
+
+    pool_future& operator=(pool_future&& other)
+    {
+        if (this != &other)
+        {
+            wait();
+            pool = other.pool;
+            fut = std::move(other.fut);
+        }
+        return *this;
+    }
+
+    ~pool_future()
+    {
+        wait();
+    }
+
+    bool valid() const
+    {
+        return fut.valid();
+    }
+
+    bool is_ready() const
+    {
+        return fut.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    void wait()
+    {
+        if (!fut.valid())
+        {
+            return;
+        }
+        if (!pool->in_worker())
+        {
+            fut.wait();
+            return;
+        }
+        while (!is_ready())
+        {
+            if (!pool->run_pending_task())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    T get()
+    {
+        wait();
+        return fut.get();
+    }
+};
+
+#endif
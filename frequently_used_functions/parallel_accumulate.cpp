@@ -1,55 +1,238 @@
 #include <iostream>
 #include <thread>
+#include <future>
+#include <mutex>
+#include <chrono>
 #include <numeric>
+#include <limits>
+#include <optional>
+#include <exception>
 #include <algorithm>
 #include <functional>
 #include <vector>
 #include <iostream>
 
-template <typename Iterator, typename T>
-struct accumulate_block
+unsigned long const auto_grain = 0;
+
+std::chrono::nanoseconds const thread_task_target = std::chrono::microseconds(200);
+
+template <typename Iterator, typename Func>
+unsigned long probe_grain_size(Iterator &first, unsigned long &length, std::chrono::nanoseconds target_task, Func &&process)
 {
-    void operator()(Iterator first, Iterator last, T &result)
+    std::chrono::steady_clock::duration elapsed(0);
+    unsigned long consumed = 0;
+    unsigned long step = 16;
+    while (length != 0 && elapsed < target_task / 4)
     {
-        result = std::accumulate(first, last, result);
+        unsigned long const count = std::min(step, length);
+        Iterator block_end = first;
+        std::advance(block_end, count);
+        const auto start = std::chrono::steady_clock::now();
+        bool const keep_going = process(first, block_end);
+        elapsed += std::chrono::steady_clock::now() - start;
+        first = block_end;
+        length -= count;
+        consumed += count;
+        step *= 2;
+        if (!keep_going)
+        {
+            length = 0;
+        }
+    }
+    double const elapsed_ns = std::max<double>(1.0, std::chrono::duration<double, std::nano>(elapsed).count());
+    double const grain = target_task.count() * static_cast<double>(consumed) / elapsed_ns;
+    return std::max(1ul, static_cast<unsigned long>(std::min<double>(grain, 1e15)));
+}
+
+class join_threads
+{
+private:
+    std::vector<std::thread> &ts;
+
+public:
+    explicit join_threads(std::vector<std::thread> &_ts) : ts(_ts) {}
+
+    ~join_threads()
+    {
+        for (auto &t : ts)
+        {
+            if (t.joinable())
+            {
+                t.join();
+            }
+        }
     }
 };
 
-template <typename Iterator, typename T>
-T parallel_accumulate(Iterator first, Iterator last, T init)
+// ordered: op is only assumed associative, partials are combined left to right in a tree.
+// commutative: partials are combined in whatever order the workers finish.
+enum class reduce_hint
 {
-    unsigned long const length = std::distance(first, last);
+    ordered,
+    commutative
+};
+
+template <typename T>
+struct alignas(64) padded_value
+{
+    T value;
+};
 
+template <typename Iterator, typename T, typename BinaryOp, typename BlockFunc>
+T parallel_reduce_blocks(Iterator first, Iterator last, T identity, BinaryOp op, reduce_hint hint, unsigned long grain, BlockFunc block_reduce)
+{
+    unsigned long length = std::distance(first, last);
+
+    T prefix = identity;
+    if (grain == auto_grain)
+    {
+        grain = probe_grain_size(first, length, thread_task_target, [&prefix, &block_reduce](Iterator block_start, Iterator block_end) {
+            prefix = block_reduce(block_start, block_end, std::move(prefix));
+            return true;
+        });
+    }
     if (!length)
     {
-        return init;
+        return prefix;
     }
-    unsigned long const min_per_thread = 25;
-    unsigned long const max_threads = (length + min_per_thread - 1) / min_per_thread;
-
+    unsigned long const max_threads = (length + grain - 1) / grain;
     unsigned long const hardware_threads = std::thread::hardware_concurrency();
-
     unsigned long const num_threads = std::min(hardware_threads != 0 ? hardware_threads : 2, max_threads);
-
     unsigned long const block_size = length / num_threads;
 
-    std::vector<T> results(num_threads);
-    std::vector<std::thread> threads(num_threads - 1);
+    std::vector<Iterator> block_starts(num_threads + 1, first);
+    for (unsigned long i = 1; i < num_threads; ++i)
+    {
+        block_starts[i] = block_starts[i - 1];
+        std::advance(block_starts[i], block_size);
+    }
+    block_starts[num_threads] = last;
 
-    Iterator block_start = first;
-    for (unsigned long i = 0; i < (num_threads - 1); ++i)
+    if (hint == reduce_hint::commutative)
     {
-        Iterator block_end = block_start;
-        std::advance(block_end, block_size);
-        threads[i] = std::thread(accumulate_block<Iterator, T>(), block_start, block_end, std::ref(results[i]));
-        block_start = block_end;
+        std::mutex combine_mutex;
+        std::optional<T> pending;
+        std::exception_ptr error;
+        auto reduce_and_combine = [&](unsigned long i) {
+            try
+            {
+                T value = block_reduce(block_starts[i], block_starts[i + 1], identity);
+                for (;;)
+                {
+                    std::unique_lock<std::mutex> lk(combine_mutex);
+                    if (!pending)
+                    {
+                        pending.emplace(std::move(value));
+                        return;
+                    }
+                    T other = std::move(*pending);
+                    pending.reset();
+                    lk.unlock();
+                    value = op(std::move(value), std::move(other));
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lk(combine_mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+            }
+        };
+        {
+            std::vector<std::thread> threads(num_threads - 1);
+            join_threads joiner(threads);
+            for (unsigned long i = 1; i < num_threads; ++i)
+            {
+                threads[i - 1] = std::thread(reduce_and_combine, i);
+            }
+            reduce_and_combine(0);
+        }
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        return op(std::move(prefix), std::move(*pending));
     }
-    accumulate_block<Iterator, T>()(block_start, last, results[num_threads - 1]);
-    for (auto &entry : threads)
+
+    // Worker i owns the subtree [i, i + 2^k): it folds in its right neighbours at strides 1, 2, 4, ... before publishing.
+    std::vector<padded_value<T>> partials(num_threads, padded_value<T>{identity});
+    std::vector<std::promise<void>> subtree_ready(num_threads);
+    std::vector<std::future<void>> subtree_futures;
+    subtree_futures.reserve(num_threads);
+    for (auto &p : subtree_ready)
     {
-        entry.join();
+        subtree_futures.push_back(p.get_future());
     }
-    return std::accumulate(results.begin(), results.end(), init);
+    auto reduce_subtree = [&](unsigned long i) {
+        partials[i].value = block_reduce(block_starts[i], block_starts[i + 1], identity);
+        for (unsigned long stride = 1; i % (2 * stride) == 0 && i + stride < num_threads; stride *= 2)
+        {
+            subtree_futures[i + stride].get();
+            partials[i].value = op(std::move(partials[i].value), std::move(partials[i + stride].value));
+        }
+    };
+    std::vector<std::thread> threads(num_threads - 1);
+    join_threads joiner(threads);
+    for (unsigned long i = 1; i < num_threads; ++i)
+    {
+        threads[i - 1] = std::thread([&, i]() {
+            try
+            {
+                reduce_subtree(i);
+                subtree_ready[i].set_value();
+            }
+            catch (...)
+            {
+                subtree_ready[i].set_exception(std::current_exception());
+            }
+        });
+    }
+    reduce_subtree(0);
+    return op(std::move(prefix), std::move(partials[0].value));
+}
+
+template <typename Iterator, typename T, typename BinaryOp>
+T parallel_reduce(Iterator first, Iterator last, T identity, BinaryOp op, reduce_hint hint = reduce_hint::ordered, unsigned long grain = auto_grain)
+{
+    return parallel_reduce_blocks(first, last, identity, op, hint, grain, [&op](Iterator block_start, Iterator block_end, T init) {
+        return std::accumulate(block_start, block_end, std::move(init), op);
+    });
+}
+
+template <typename Iterator, typename T, typename BinaryOp, typename UnaryOp>
+T parallel_transform_reduce(Iterator first, Iterator last, T identity, BinaryOp reduce_op, UnaryOp transform_op, reduce_hint hint = reduce_hint::ordered, unsigned long grain = auto_grain)
+{
+    return parallel_reduce_blocks(first, last, identity, reduce_op, hint, grain, [&reduce_op, &transform_op](Iterator block_start, Iterator block_end, T init) {
+        for (; block_start != block_end; ++block_start)
+        {
+            init = reduce_op(std::move(init), transform_op(*block_start));
+        }
+        return init;
+    });
+}
+
+template <typename Iterator, typename T>
+T parallel_accumulate(Iterator first, Iterator last, T init, unsigned long grain = auto_grain)
+{
+    return init + parallel_reduce(first, last, T(), std::plus<T>(), reduce_hint::commutative, grain);
+}
+
+struct mat2
+{
+    long long a, b, c, d;
+
+    bool operator==(mat2 const &other) const
+    {
+        return a == other.a && b == other.b && c == other.c && d == other.d;
+    }
+};
+
+mat2 multiply_mod(mat2 const &x, mat2 const &y)
+{
+    long long const m = 1000000007;
+    return mat2{(x.a * y.a + x.b * y.c) % m, (x.a * y.b + x.b * y.d) % m, (x.c * y.a + x.d * y.c) % m, (x.c * y.b + x.d * y.d) % m};
 }
 
 int main()
@@ -62,5 +245,36 @@ int main()
     int sum = parallel_accumulate(vi.begin(), vi.end(), 0);
     std::cout << "sum = " << sum << std::endl;
 
+    std::vector<long long> vl(10000000, 1);
+    const auto start = std::chrono::steady_clock::now();
+    long long const auto_sum = parallel_accumulate(vl.begin(), vl.end(), 0LL);
+    const auto mid = std::chrono::steady_clock::now();
+    long long const fixed_sum = parallel_accumulate(vl.begin(), vl.end(), 0LL, 25);
+    const auto end = std::chrono::steady_clock::now();
+    std::cout << "auto grain sum = " << auto_sum << ", " << std::chrono::duration_cast<std::chrono::microseconds>(mid - start).count() << "us" << std::endl;
+    std::cout << "grain 25 sum = " << fixed_sum << ", " << std::chrono::duration_cast<std::chrono::microseconds>(end - mid).count() << "us" << std::endl;
+
+    std::vector<int> values(1000000);
+    for (int i = 0; i < static_cast<int>(values.size()); ++i)
+    {
+        values[i] = static_cast<int>(i * 7919LL % 1000003) - 500000;
+    }
+    int const min_value = parallel_reduce(values.begin(), values.end(), std::numeric_limits<int>::max(), [](int x, int y) { return std::min(x, y); }, reduce_hint::commutative);
+    std::vector<double> factors(1000, 1.001);
+    double const product = parallel_reduce(factors.begin(), factors.end(), 1.0, std::multiplies<double>(), reduce_hint::ordered, 10);
+    long long const squares = parallel_transform_reduce(values.begin(), values.end(), 0LL, std::plus<long long>(), [](int x) { return 1LL * x * x; });
+    std::cout << "min = " << min_value << " (expected " << *std::min_element(values.begin(), values.end()) << ")" << std::endl;
+    std::cout << "product = " << product << " (expected " << std::accumulate(factors.begin(), factors.end(), 1.0, std::multiplies<double>()) << ")" << std::endl;
+    std::cout << "sum of squares = " << squares << " (expected " << std::accumulate(values.begin(), values.end(), 0LL, [](long long acc, int x) { return acc + 1LL * x * x; }) << ")" << std::endl;
+
+    std::vector<mat2> matrices(100000);
+    for (std::size_t i = 0; i < matrices.size(); ++i)
+    {
+        matrices[i] = mat2{static_cast<long long>(i % 5), 1, static_cast<long long>(i % 3), 2};
+    }
+    mat2 const identity{1, 0, 0, 1};
+    bool const ordered_ok = parallel_reduce(matrices.begin(), matrices.end(), identity, multiply_mod, reduce_hint::ordered, 1000) == std::accumulate(matrices.begin(), matrices.end(), identity, multiply_mod);
+    std::cout << "non-commutative matrix product " << (ordered_ok ? "matches" : "does not match") << " sequential order" << std::endl;
+
     return 0;
 }
@@ -1,18 +1,93 @@
+#include <iostream>
 #include <map>
 #include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
 #include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
 #include <shared_mutex>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 class dns_entry
 {
 };
 
+class mapped_snapshot
+{
+private:
+    void *addr;
+    std::size_t length;
+
+public:
+    explicit mapped_snapshot(std::string const &path) : addr(nullptr), length(0)
+    {
+        int const fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Cannot open snapshot " + path + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            int const err = errno;
+            ::close(fd);
+            throw std::runtime_error("Cannot stat snapshot " + path + ": " + std::strerror(err));
+        }
+        length = static_cast<std::size_t>(st.st_size);
+        if (length != 0)
+        {
+            addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        int const err = errno;
+        ::close(fd);
+        if (addr == MAP_FAILED)
+        {
+            throw std::runtime_error("Cannot map snapshot " + path + ": " + std::strerror(err));
+        }
+        ::madvise(addr, length, MADV_SEQUENTIAL);
+    }
+
+    mapped_snapshot(mapped_snapshot const &other) = delete;
+
+    mapped_snapshot &operator=(mapped_snapshot const &other) = delete;
+
+    ~mapped_snapshot()
+    {
+        if (addr)
+        {
+            ::munmap(addr, length);
+        }
+    }
+
+    char const *data() const
+    {
+        return static_cast<char const *>(addr);
+    }
+
+    std::size_t size() const
+    {
+        return length;
+    }
+};
+
 class dns_cache
 {
 private:
     std::map<std::string, dns_entry> entries;
     std::shared_mutex entry_mutex;
 
+    static constexpr char snapshot_magic[8] = {'D', 'N', 'S', 'C', 'S', 'N', 'A', 'P'};
+
 public:
     dns_entry find_entry(std::string const &domain)
     {
@@ -26,11 +101,107 @@ public:
         std::lock_guard<std::shared_mutex> lk(entry_mutex);
         entries[domain] = dns_details;
     }
+
+    std::vector<std::pair<std::string, dns_entry>> copy_entries()
+    {
+        std::shared_lock<std::shared_mutex> lk(entry_mutex);
+        return std::vector<std::pair<std::string, dns_entry>>(entries.begin(), entries.end());
+    }
+
+    // Entries are copied out first so writers are only blocked for the copy, not for the file I/O.
+    void save_snapshot(std::string const &path)
+    {
+        static_assert(std::is_trivially_copyable<dns_entry>::value, "snapshots need a trivially copyable dns_entry");
+        std::vector<std::pair<std::string, dns_entry>> const snapshot = copy_entries();
+        std::string const tmp_path = path + ".tmp";
+        std::FILE *out = std::fopen(tmp_path.c_str(), "wb");
+        if (!out)
+        {
+            throw std::runtime_error("Cannot create snapshot " + tmp_path + ": " + std::strerror(errno));
+        }
+        std::setvbuf(out, nullptr, _IOFBF, 1 << 20);
+        std::uint64_t const header[3] = {1, snapshot.size(), sizeof(dns_entry)};
+        bool ok = std::fwrite(snapshot_magic, sizeof(snapshot_magic), 1, out) == 1 && std::fwrite(header, sizeof(header), 1, out) == 1;
+        for (auto it = snapshot.begin(); ok && it != snapshot.end(); ++it)
+        {
+            std::uint32_t const domain_size = static_cast<std::uint32_t>(it->first.size());
+            ok = std::fwrite(&domain_size, sizeof(domain_size), 1, out) == 1 && std::fwrite(it->first.data(), 1, domain_size, out) == domain_size && std::fwrite(&it->second, sizeof(dns_entry), 1, out) == 1;
+        }
+        // The data has to be on disk before the rename makes it the snapshot, or a crash can leave a truncated file behind.
+        ok = ok && std::fflush(out) == 0 && ::fsync(::fileno(out)) == 0;
+        ok = std::fclose(out) == 0 && ok;
+        if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        {
+            std::remove(tmp_path.c_str());
+            throw std::runtime_error("Cannot write snapshot " + path);
+        }
+    }
+
+    void load_snapshot(std::string const &path)
+    {
+        mapped_snapshot const mapping(path);
+        char const *cur = mapping.data();
+        char const *const end = cur + mapping.size();
+        auto read = [&](void *dst, std::size_t n) {
+            if (static_cast<std::size_t>(end - cur) < n)
+            {
+                throw std::runtime_error("Snapshot " + path + " is truncated");
+            }
+            std::memcpy(dst, cur, n);
+            cur += n;
+        };
+        char magic[sizeof(snapshot_magic)];
+        std::uint64_t header[3];
+        read(magic, sizeof(magic));
+        read(header, sizeof(header));
+        if (std::memcmp(magic, snapshot_magic, sizeof(magic)) != 0 || header[0] != 1 || header[2] != sizeof(dns_entry))
+        {
+            throw std::runtime_error("Snapshot " + path + " does not match this cache type");
+        }
+        std::map<std::string, dns_entry> loaded;
+        for (std::uint64_t i = 0; i < header[1]; ++i)
+        {
+            std::uint32_t domain_size;
+            read(&domain_size, sizeof(domain_size));
+            if (static_cast<std::size_t>(end - cur) < domain_size)
+            {
+                throw std::runtime_error("Snapshot " + path + " is truncated");
+            }
+            std::string domain(cur, domain_size);
+            cur += domain_size;
+            dns_entry details;
+            read(&details, sizeof(dns_entry));
+            loaded.emplace_hint(loaded.end(), std::move(domain), details);
+        }
+        std::lock_guard<std::shared_mutex> lk(entry_mutex);
+        entries.swap(loaded);
+    }
 };
 
 int main()
 {
     dns_cache test;
 
+    for (int i = 0; i < 100000; ++i)
+    {
+        test.update_or_add_entry("host" + std::to_string(i) + ".example.com", dns_entry());
+    }
+    std::string const snapshot_path = "/tmp/dns_cache.snapshot";
+    test.save_snapshot(snapshot_path);
+
+    dns_cache warm;
+    const auto start = std::chrono::steady_clock::now();
+    warm.load_snapshot(snapshot_path);
+    const auto end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double, std::milli> consumption = end - start;
+    std::remove(snapshot_path.c_str());
+    std::vector<std::pair<std::string, dns_entry>> const saved = test.copy_entries();
+    std::vector<std::pair<std::string, dns_entry>> const loaded = warm.copy_entries();
+    bool const same = saved.size() == loaded.size() && std::equal(saved.begin(), saved.end(), loaded.begin(), [](auto const &a, auto const &b) {
+        return a.first == b.first && std::memcmp(&a.second, &b.second, sizeof(dns_entry)) == 0;
+    });
+    std::cout << "Load dns_cache snapshot of " << loaded.size() << " entries " << (same ? "ok" : "wrong") << ".\n";
+    std::cout << "Total consuming times: " << consumption.count() << "ms.\n";
+
     return 0;
 }
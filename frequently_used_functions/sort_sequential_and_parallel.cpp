@@ -1,8 +1,19 @@
 #include <iostream>
 #include <list>
-#include <future>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
 #include <string>
+#include <thread>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <numeric>
+#include <iterator>
+#include <exception>
 #include <algorithm>
+#include <functional>
 
 template <typename T>
 std::list<T> sequential_quick_sort(std::list<T> input)
@@ -28,47 +39,203 @@ std::list<T> sequential_quick_sort(std::list<T> input)
     return result;
 }
 
-template <typename T>
-std::list<T> parallel_quick_sort(std::list<T> input)
+class join_threads
 {
-    if (input.empty())
+private:
+    std::vector<std::thread> &ts;
+
+public:
+    explicit join_threads(std::vector<std::thread> &_ts) : ts(_ts) {}
+
+    ~join_threads()
     {
-        return input;
+        for (auto &t : ts)
+        {
+            if (t.joinable())
+            {
+                t.join();
+            }
+        }
     }
-    std::list<T> result;
-    result.splice(result.begin(), input, input.begin());
-    const T &pivot = *result.begin();
+};
 
-    auto divide_point = std::partition(input.begin(), input.end(), [&](const T &t) {
-        return t < pivot;
+// Runs f(id) for id in [0, num_threads), the calling thread taking id 0, and rethrows the first exception.
+template <typename Func>
+void run_on_threads(unsigned long num_threads, Func &&f)
+{
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto run = [&](unsigned long id) {
+        try
+        {
+            f(id);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lk(error_mutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    };
+    {
+        std::vector<std::thread> threads(num_threads - 1);
+        join_threads joiner(threads);
+        for (unsigned long i = 1; i < num_threads; ++i)
+        {
+            threads[i - 1] = std::thread(run, i);
+        }
+        run(0);
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+std::size_t const sample_sort_cutoff = 1 << 14;
+std::size_t const buckets_per_thread = 4;
+std::size_t const oversampling = 32;
+// Bucket ids are stored as std::uint16_t. n sample buckets give at most n - 1 splitters and 2 * (n - 1) + 1 buckets, so
+// this cap keeps every id below 65535 however many threads there are.
+std::size_t const max_sample_buckets = (std::numeric_limits<std::uint16_t>::max() + 1) / 2;
+
+// Sample sort: splitters picked from a sorted random sample cut the range into buckets. Each thread classifies its own
+// block and scatters it into a buffer at offsets precomputed from the per-block bucket counts, then threads sort whole
+// buckets independently and move them back. A splitter gets its own equality bucket, which needs no sorting, so sorted
+// input and heavy duplicates stay balanced.
+template <typename Iterator, typename Compare = std::less<>>
+void parallel_sample_sort(Iterator first, Iterator last, Compare comp = Compare())
+{
+    using value_type = typename std::iterator_traits<Iterator>::value_type;
+
+    std::size_t const length = last - first;
+    unsigned long const hardware_threads = std::thread::hardware_concurrency();
+    unsigned long const num_threads = std::min<std::size_t>(hardware_threads != 0 ? hardware_threads : 2, length / sample_sort_cutoff);
+    if (num_threads <= 1)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    std::size_t const sample_count = std::min(num_threads * buckets_per_thread, max_sample_buckets) * oversampling;
+    std::mt19937_64 rng(length);
+    std::vector<value_type> sample;
+    sample.reserve(sample_count);
+    for (std::size_t i = 0; i < sample_count; ++i)
+    {
+        sample.push_back(first[rng() % length]);
+    }
+    std::sort(sample.begin(), sample.end(), comp);
+    std::vector<value_type> splitters;
+    for (std::size_t i = oversampling; i < sample_count; i += oversampling)
+    {
+        if (splitters.empty() || comp(splitters.back(), sample[i]))
+        {
+            splitters.push_back(sample[i]);
+        }
+    }
+
+    // Bucket 2j holds the elements strictly between splitters j - 1 and j, bucket 2j + 1 the elements equal to splitter j.
+    std::size_t const bucket_count = 2 * splitters.size() + 1;
+    auto classify = [&splitters, &comp](const value_type &value) {
+        std::size_t const j = std::upper_bound(splitters.begin(), splitters.end(), value, comp) - splitters.begin();
+        return static_cast<std::uint16_t>(j > 0 && !comp(splitters[j - 1], value) ? 2 * j - 1 : 2 * j);
+    };
+    auto block_start = [length, num_threads](unsigned long t) { return t * (length / num_threads); };
+    auto block_end = [length, num_threads, &block_start](unsigned long t) { return t + 1 == num_threads ? length : block_start(t + 1); };
+
+    std::vector<std::uint16_t> bucket_of(length);
+    std::vector<std::size_t> counts(num_threads * bucket_count);
+    run_on_threads(num_threads, [&](unsigned long t) {
+        std::size_t *const block_counts = &counts[t * bucket_count];
+        for (std::size_t i = block_start(t); i < block_end(t); ++i)
+        {
+            bucket_of[i] = classify(first[i]);
+            ++block_counts[bucket_of[i]];
+        }
     });
-    std::list<T> lower_part;
-    lower_part.splice(lower_part.end(), input, input.begin(), divide_point);
 
-    std::future<std::list<T>> new_lower(std::async(&parallel_quick_sort<T>, std::move(lower_part)));
-    auto new_higher(parallel_quick_sort(std::move(input)));
+    // Turn counts into write positions: bucket by bucket, and within a bucket block by block.
+    std::vector<std::size_t> bucket_starts(bucket_count + 1);
+    std::size_t offset = 0;
+    for (std::size_t b = 0; b < bucket_count; ++b)
+    {
+        bucket_starts[b] = offset;
+        for (unsigned long t = 0; t < num_threads; ++t)
+        {
+            std::size_t const count = counts[t * bucket_count + b];
+            counts[t * bucket_count + b] = offset;
+            offset += count;
+        }
+    }
+    bucket_starts[bucket_count] = length;
+
+    std::vector<value_type> buffer(length);
+    run_on_threads(num_threads, [&](unsigned long t) {
+        std::size_t *const positions = &counts[t * bucket_count];
+        for (std::size_t i = block_start(t); i < block_end(t); ++i)
+        {
+            buffer[positions[bucket_of[i]]++] = std::move(first[i]);
+        }
+    });
 
-    result.splice(result.end(), new_higher);
-    result.splice(result.begin(), new_lower.get());
-    return result;
+    std::atomic<std::size_t> next_bucket(0);
+    run_on_threads(num_threads, [&](unsigned long) {
+        for (std::size_t b = next_bucket.fetch_add(1); b < bucket_count; b = next_bucket.fetch_add(1))
+        {
+            auto const bucket_begin = buffer.begin() + bucket_starts[b];
+            auto const bucket_end = buffer.begin() + bucket_starts[b + 1];
+            if (b % 2 == 0)
+            {
+                std::sort(bucket_begin, bucket_end, comp);
+            }
+            std::move(bucket_begin, bucket_end, first + bucket_starts[b]);
+        }
+    });
 }
 
 int main()
 {
     auto test_sequential = sequential_quick_sort(std::list<int>{6, 5, 8, 2, 1});
-    auto test_parallel = parallel_quick_sort(std::list<int>{3, 2, 7, 6, 8, 9});
+    std::vector<int> test_parallel{3, 2, 7, 6, 8, 9};
+    parallel_sample_sort(test_parallel.begin(), test_parallel.end());
 
-    auto check = [&](std::string s, std::list<int> &lists)
+    auto check = [&](std::string s, const auto &values)
     {
         std::cout << s << std::endl;
-        for (auto &t : lists)
+        for (auto &t : values)
         {
             std::cout << t << " ";
         }
         std::cout << std::endl;
     };
     check("Test sequential_quick_sort:", test_sequential);
-    check("Test parallel_quick_sort:", test_parallel);
+    check("Test parallel_sample_sort:", test_parallel);
+
+    std::mt19937 rng(42);
+    std::vector<int> random_keys(10000000);
+    for (auto &k : random_keys)
+    {
+        k = static_cast<int>(rng());
+    }
+    std::vector<int> few_keys(random_keys.size());
+    for (auto &k : few_keys)
+    {
+        k = static_cast<int>(rng() % 4);
+    }
+    std::vector<int> sorted_keys(random_keys.size());
+    std::iota(sorted_keys.begin(), sorted_keys.end(), 0);
+    for (auto *keys : {&random_keys, &few_keys, &sorted_keys})
+    {
+        std::vector<int> expected(*keys);
+        std::sort(expected.begin(), expected.end());
+        const auto start = std::chrono::steady_clock::now();
+        parallel_sample_sort(keys->begin(), keys->end());
+        const auto end = std::chrono::steady_clock::now();
+        std::cout << "parallel_sample_sort of " << keys->size() << " keys " << (*keys == expected ? "ok" : "wrong") << ", " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+    }
 
     return 0;
 }
@@ -5,6 +5,35 @@
 #include <queue>
 #include <memory>
 #include <vector>
+#include <chrono>
+#include <limits>
+#include <atomic>
+#include <algorithm>
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+struct wait_strategy
+{
+    unsigned int spin_iterations;
+    unsigned int yield_iterations;
+
+    static wait_strategy park_only()
+    {
+        return wait_strategy{0, 0};
+    }
+
+    static wait_strategy adaptive()
+    {
+        return wait_strategy{std::thread::hardware_concurrency() > 1 ? 4000u : 0u, 16};
+    }
+};
 
 template <typename T>
 class threadsafe_queue
@@ -13,38 +42,135 @@ private:
     mutable std::mutex mut;
     std::queue<std::shared_ptr<T>> data_queue;
     std::condition_variable data_cond;
+    std::size_t capacity;
+    std::size_t waiting_producers;
+    std::condition_variable not_full_cond;
+    wait_strategy strategy;
+    std::atomic<std::size_t> item_count;
+    std::size_t waiting_consumers;
+
+    void push_locked(std::unique_lock<std::mutex> &lk, std::shared_ptr<T> data)
+    {
+        data_queue.push(std::move(data));
+        item_count.store(data_queue.size(), std::memory_order_release);
+        bool const wake = waiting_consumers != 0;
+        lk.unlock();
+        if (wake)
+        {
+            data_cond.notify_one();
+        }
+    }
+
+    void pop_locked()
+    {
+        data_queue.pop();
+        item_count.store(data_queue.size(), std::memory_order_relaxed);
+        if (waiting_producers)
+        {
+            not_full_cond.notify_one();
+        }
+    }
+
+    std::unique_lock<std::mutex> wait_for_data()
+    {
+        unsigned int const busy_iterations = strategy.spin_iterations + strategy.yield_iterations;
+        for (unsigned int i = 0; i < busy_iterations; ++i)
+        {
+            if (item_count.load(std::memory_order_acquire) != 0)
+            {
+                std::unique_lock<std::mutex> lk(mut);
+                if (!data_queue.empty())
+                {
+                    return lk;
+                }
+            }
+            else if (i < strategy.spin_iterations)
+            {
+                cpu_relax();
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+        std::unique_lock<std::mutex> lk(mut);
+        if (data_queue.empty())
+        {
+            ++waiting_consumers;
+            data_cond.wait(lk, [this]{ return !data_queue.empty(); });
+            --waiting_consumers;
+        }
+        return lk;
+    }
 
 public:
-    threadsafe_queue() {}
+    explicit threadsafe_queue(std::size_t _capacity = std::numeric_limits<std::size_t>::max(), wait_strategy _strategy = wait_strategy::adaptive()) : capacity(_capacity), waiting_producers(0), strategy(_strategy), item_count(0), waiting_consumers(0) {}
 
-    threadsafe_queue(const threadsafe_queue &other)
+    threadsafe_queue(const threadsafe_queue &other) : waiting_producers(0), item_count(0), waiting_consumers(0)
     {
         std::lock_guard<std::mutex> lk(other.mut);
         data_queue = other.data_queue;
+        capacity = other.capacity;
+        strategy = other.strategy;
+        item_count.store(data_queue.size());
     }
 
     void push(T new_value)
     {
         std::shared_ptr<T> data(std::make_shared<T>(std::move(new_value)));
-        std::lock_guard<std::mutex> lk(mut);
-        data_queue.push(data);
-        data_cond.notify_one();
+        std::unique_lock<std::mutex> lk(mut);
+        if (data_queue.size() >= capacity)
+        {
+            ++waiting_producers;
+            not_full_cond.wait(lk, [this]{ return data_queue.size() < capacity; });
+            --waiting_producers;
+        }
+        push_locked(lk, std::move(data));
     }
 
-    void wait_and_pop(T &value)
+    bool try_push(T new_value)
     {
+        std::shared_ptr<T> data(std::make_shared<T>(std::move(new_value)));
         std::unique_lock<std::mutex> lk(mut);
-        data_cond.wait(lk, [this]{ return !data_queue.empty(); });
+        if (data_queue.size() >= capacity)
+        {
+            return false;
+        }
+        push_locked(lk, std::move(data));
+        return true;
+    }
+
+    template <typename Rep, typename Period>
+    bool push_for(T new_value, std::chrono::duration<Rep, Period> const &timeout)
+    {
+        std::shared_ptr<T> data(std::make_shared<T>(std::move(new_value)));
+        std::unique_lock<std::mutex> lk(mut);
+        if (data_queue.size() >= capacity)
+        {
+            ++waiting_producers;
+            bool const ready = not_full_cond.wait_for(lk, timeout, [this]{ return data_queue.size() < capacity; });
+            --waiting_producers;
+            if (!ready)
+            {
+                return false;
+            }
+        }
+        push_locked(lk, std::move(data));
+        return true;
+    }
+
+    void wait_and_pop(T &value)
+    {
+        std::unique_lock<std::mutex> lk(wait_for_data());
         value = std::move(*data_queue.front());
-        data_queue.pop();
+        pop_locked();
     }
 
     std::shared_ptr<T> wait_and_pop()
     {
-        std::unique_lock<std::mutex> lk(mut);
-        data_cond.wait(lk, [this]{ return !data_queue.empty(); });
+        std::unique_lock<std::mutex> lk(wait_for_data());
         std::shared_ptr<T> res(data_queue.front());
-        data_queue.pop();
+        pop_locked();
         return res;
     }
 
@@ -56,7 +182,7 @@ public:
             return false;
         }
         value = std::move(*data_queue.front());
-        data_queue.pop();
+        pop_locked();
         return true;
     }
 
@@ -68,7 +194,7 @@ public:
             return std::shared_ptr<T>();
         }
         std::shared_ptr<T> res(data_queue.front());
-        data_queue.pop();
+        pop_locked();
         return res;
     }
 
@@ -101,6 +227,34 @@ void data_processing_thread()
     }
 }
 
+void measure_handoff_latency(char const *name, wait_strategy strategy)
+{
+    constexpr int rounds = 20000;
+    threadsafe_queue<int> ping(std::numeric_limits<std::size_t>::max(), strategy);
+    threadsafe_queue<int> pong(std::numeric_limits<std::size_t>::max(), strategy);
+    std::vector<double> samples;
+    samples.reserve(rounds);
+
+    std::thread echo([&]() {
+        for (int i = 0; i < rounds; ++i)
+        {
+            pong.push(*ping.wait_and_pop());
+        }
+    });
+    for (int i = 0; i < rounds; ++i)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        ping.push(i);
+        pong.wait_and_pop();
+        const auto end = std::chrono::steady_clock::now();
+        samples.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    }
+    echo.join();
+
+    std::sort(samples.begin(), samples.end());
+    std::cout << name << " round trip p50: " << samples[rounds / 2] << "us, p99: " << samples[rounds * 99 / 100] << "us.\n";
+}
+
 int main()
 {
     std::vector<int> nums({1, 2, 3, 4, 5, 6});
@@ -110,5 +264,32 @@ int main()
     t1.join();
     t2.join();
 
+    threadsafe_queue<int> bounded_queue(4);
+    long long consumed = 0;
+    std::thread t3([&]() {
+        for (int i = 1; i <= 1000; ++i)
+        {
+            bounded_queue.push(i);
+        }
+    });
+    std::thread t4([&]() {
+        for (int i = 1; i <= 1000; ++i)
+        {
+            consumed += *bounded_queue.wait_and_pop();
+        }
+    });
+    t3.join();
+    t4.join();
+
+    for (int i = 0; i < 4; ++i)
+    {
+        bounded_queue.push(i);
+    }
+    bool const rejected = !bounded_queue.try_push(4) && !bounded_queue.push_for(4, std::chrono::milliseconds(10));
+    std::cout << "Test bounded threadsafe_queue " << (consumed == 500500 && rejected ? "successfully.\n" : "unsuccessfully.\n");
+
+    measure_handoff_latency("Park only", wait_strategy::park_only());
+    measure_handoff_latency("Spin, yield, park", wait_strategy::adaptive());
+
     return 0;
 }
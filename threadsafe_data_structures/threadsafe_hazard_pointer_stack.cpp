@@ -73,6 +73,48 @@ std::atomic<void *> &get_hazard_pointer_for_current_thread()
     return hazard.get_pointer();
 }
 
+class eventcount
+{
+private:
+    std::atomic<unsigned int> epoch;
+    std::atomic<unsigned int> waiters;
+
+public:
+    eventcount() : epoch(0), waiters(0) {}
+
+    eventcount(eventcount const &other) = delete;
+
+    eventcount &operator=(eventcount const &other) = delete;
+
+    unsigned int prepare_wait()
+    {
+        waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_acquire);
+    }
+
+    void cancel_wait()
+    {
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void commit_wait(unsigned int key)
+    {
+        epoch.wait(key, std::memory_order_acquire);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify_one()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) != 0)
+        {
+            epoch.fetch_add(1, std::memory_order_release);
+            epoch.notify_one();
+        }
+    }
+};
+
 template <typename T>
 class hazard_pointer_stack
 {
@@ -91,6 +133,7 @@ private:
         ~data_to_reclaim() { delete reclaim_data; }
     };
     std::atomic<node *> head = nullptr;
+    eventcount data_event;
     std::atomic<data_to_reclaim *> nodes_to_reclaim = nullptr;
 
     hazard_pointer_stack(const hazard_pointer_stack &) = delete;
@@ -134,6 +177,7 @@ public:
         node *const new_node = new node(val);
         new_node->next = head.load();
         while (!head.compare_exchange_weak(new_node->next, new_node)) continue;
+        data_event.notify_one();
     }
 
     std::shared_ptr<T> pop()
@@ -167,6 +211,24 @@ public:
         }
         return res;
     }
+
+    std::shared_ptr<T> wait_pop()
+    {
+        for (;;)
+        {
+            if (std::shared_ptr<T> res = pop())
+            {
+                return res;
+            }
+            unsigned int const key = data_event.prepare_wait();
+            if (std::shared_ptr<T> res = pop())
+            {
+                data_event.cancel_wait();
+                return res;
+            }
+            data_event.commit_wait(key);
+        }
+    }
 };
 
 int main()
@@ -185,34 +247,42 @@ int main()
     });
 
     std::thread t2([&]() {
-        while (rmset.size() < 10)
+        for (;;)
         {
-            auto hd = test_stack.pop();
-            if (!hd)
+            auto hd = test_stack.wait_pop();
+            if (*hd == 0)
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
+                break;
             }
             std::lock_guard<std::mutex> lk(mtx);
             rmset.insert(*hd);
             std::string str = "Pop value: " + std::to_string(*hd) + " from hazard_pointer_stack successfully.\n";
             std::cout << str;
+            if (rmset.size() == 10)
+            {
+                test_stack.push(0);
+                break;
+            }
         }
     });
 
     std::thread t3([&]() {
-        while (rmset.size() < 10)
+        for (;;)
         {
-            auto hd = test_stack.pop();
-            if (!hd)
+            auto hd = test_stack.wait_pop();
+            if (*hd == 0)
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
+                break;
             }
             std::lock_guard<std::mutex> lk(mtx);
             rmset.insert(*hd);
             std::string str = "Pop value: " + std::to_string(*hd) + " from hazard_pointer_stack successfully.\n";
             std::cout << str;
+            if (rmset.size() == 10)
+            {
+                test_stack.push(0);
+                break;
+            }
         }
     });
 
@@ -0,0 +1,147 @@
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <type_traits>
+
+struct intrusive_queue_hook
+{
+    std::atomic<intrusive_queue_hook *> next;
+    intrusive_queue_hook() : next(nullptr) {}
+    intrusive_queue_hook(intrusive_queue_hook const &) : next(nullptr) {}
+    intrusive_queue_hook &operator=(intrusive_queue_hook const &) { return *this; }
+};
+
+template <typename T>
+class threadsafe_intrusive_queue
+{
+    static_assert(std::is_base_of<intrusive_queue_hook, T>::value, "T must derive from intrusive_queue_hook");
+
+private:
+    intrusive_queue_hook stub;
+    intrusive_queue_hook *tail;
+    std::atomic<unsigned int> waiters;
+    std::mutex head_mutex, tail_mutex;
+    std::condition_variable data_cond;
+
+    T *pop_first()
+    {
+        intrusive_queue_hook *const first = stub.next.load();
+        intrusive_queue_hook *ne = first->next.load();
+        if (!ne)
+        {
+            std::lock_guard<std::mutex> tail_lock(tail_mutex);
+            ne = first->next.load();
+            if (!ne)
+            {
+                stub.next.store(nullptr);
+                tail = &stub;
+                return static_cast<T *>(first);
+            }
+        }
+        stub.next.store(ne);
+        first->next.store(nullptr, std::memory_order_relaxed);
+        return static_cast<T *>(first);
+    }
+
+public:
+    threadsafe_intrusive_queue() : tail(&stub), waiters(0) {}
+
+    threadsafe_intrusive_queue(const threadsafe_intrusive_queue &other) = delete;
+
+    threadsafe_intrusive_queue &operator=(const threadsafe_intrusive_queue &other) = delete;
+
+    void push(T &item)
+    {
+        intrusive_queue_hook *const hook = &item;
+        hook->next.store(nullptr, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> tail_lock(tail_mutex);
+            tail->next.store(hook);
+            tail = hook;
+        }
+        if (waiters.load())
+        {
+            {
+                std::lock_guard<std::mutex> head_lock(head_mutex);
+            }
+            data_cond.notify_one();
+        }
+    }
+
+    T *wait_and_pop()
+    {
+        std::unique_lock<std::mutex> head_lock(head_mutex);
+        if (!stub.next.load())
+        {
+            ++waiters;
+            data_cond.wait(head_lock, [&]{ return stub.next.load() != nullptr; });
+            --waiters;
+        }
+        return pop_first();
+    }
+
+    T *try_pop()
+    {
+        std::lock_guard<std::mutex> head_lock(head_mutex);
+        return stub.next.load() ? pop_first() : nullptr;
+    }
+
+    bool empty()
+    {
+        std::lock_guard<std::mutex> head_lock(head_mutex);
+        return stub.next.load() == nullptr;
+    }
+};
+
+struct message : intrusive_queue_hook
+{
+    int id;
+    long long payload;
+};
+
+int main()
+{
+    constexpr int total_messages = 100000;
+    std::vector<message> messages(total_messages);
+    threadsafe_intrusive_queue<message> work_queue;
+    threadsafe_intrusive_queue<message> done_queue;
+    long long consumed = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::thread t1([&]() {
+        for (int i = 0; i < total_messages; ++i)
+        {
+            messages[i].id = i;
+            messages[i].payload = i + 1;
+            work_queue.push(messages[i]);
+        }
+    });
+
+    std::thread t2([&]() {
+        for (int i = 0; i < total_messages; ++i)
+        {
+            message *msg = work_queue.wait_and_pop();
+            consumed += msg->payload;
+            done_queue.push(*msg);
+        }
+    });
+    t1.join();
+    t2.join();
+    const auto end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double, std::milli> consumption = end - start;
+
+    int returned = 0;
+    while (done_queue.try_pop())
+    {
+        ++returned;
+    }
+    bool const success = consumed == 1LL * total_messages * (total_messages + 1) / 2 && returned == total_messages && work_queue.empty();
+    std::cout << "Test threadsafe_intrusive_queue " << (success ? "successfully.\n" : "unsuccessfully.\n");
+    std::cout << "Total consuming times: " << consumption.count() << "ms.\n";
+
+    return 0;
+}
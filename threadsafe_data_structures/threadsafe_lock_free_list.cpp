@@ -0,0 +1,280 @@
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <functional>
+
+template <typename T>
+class lock_free_list
+{
+private:
+    struct node
+    {
+        std::shared_ptr<T> data;
+        std::atomic<node *> next;
+        node *next_to_be_deleted;
+        node() : next(nullptr), next_to_be_deleted(nullptr) {}
+        node(T const &value) : data(std::make_shared<T>(value)), next(nullptr), next_to_be_deleted(nullptr) {}
+    };
+    node head;
+    std::atomic<unsigned int> threads_in_list;
+    std::atomic<node *> to_be_deleted;
+
+    class list_guard
+    {
+    private:
+        lock_free_list &list;
+
+    public:
+        explicit list_guard(lock_free_list &_list) : list(_list)
+        {
+            ++list.threads_in_list;
+        }
+
+        list_guard(list_guard const &other) = delete;
+
+        list_guard &operator=(list_guard const &other) = delete;
+
+        ~list_guard()
+        {
+            list.try_reclaim();
+        }
+    };
+
+    static bool is_marked(node *p)
+    {
+        return reinterpret_cast<std::uintptr_t>(p) & 1;
+    }
+
+    static node *get_marked(node *p)
+    {
+        return reinterpret_cast<node *>(reinterpret_cast<std::uintptr_t>(p) | 1);
+    }
+
+    static node *get_unmarked(node *p)
+    {
+        return reinterpret_cast<node *>(reinterpret_cast<std::uintptr_t>(p) & ~std::uintptr_t(1));
+    }
+
+    static void delete_nodes(node *nodes)
+    {
+        while (nodes)
+        {
+            node *ne = nodes->next_to_be_deleted;
+            delete nodes;
+            nodes = ne;
+        }
+    }
+
+    void chain_pending_nodes(node *first, node *last)
+    {
+        last->next_to_be_deleted = to_be_deleted.load();
+        while (!to_be_deleted.compare_exchange_weak(last->next_to_be_deleted, first)) continue;
+    }
+
+    void chain_pending_nodes(node *nodes)
+    {
+        node *last = nodes;
+        while (node *const ne = last->next_to_be_deleted)
+        {
+            last = ne;
+        }
+        chain_pending_nodes(nodes, last);
+    }
+
+    void try_reclaim()
+    {
+        if (threads_in_list == 1)
+        {
+            node *nodes_to_delete = to_be_deleted.exchange(nullptr);
+            if (--threads_in_list == 0)
+            {
+                delete_nodes(nodes_to_delete);
+            }
+            else if (nodes_to_delete)
+            {
+                chain_pending_nodes(nodes_to_delete);
+            }
+            return;
+        }
+        --threads_in_list;
+    }
+
+    bool unlink(node *pred, node *cur, node *ne)
+    {
+        if (!pred->next.compare_exchange_strong(cur, ne))
+        {
+            return false;
+        }
+        chain_pending_nodes(cur, cur);
+        return true;
+    }
+
+public:
+    lock_free_list() : threads_in_list(0), to_be_deleted(nullptr) {}
+
+    ~lock_free_list()
+    {
+        node *cur = get_unmarked(head.next.load());
+        while (cur)
+        {
+            node *ne = get_unmarked(cur->next.load());
+            delete cur;
+            cur = ne;
+        }
+        delete_nodes(to_be_deleted.load());
+    }
+
+    lock_free_list(lock_free_list const &other) = delete;
+
+    lock_free_list &operator=(lock_free_list const &other) = delete;
+
+    void push_front(T const &value)
+    {
+        node *const new_node = new node(value);
+        node *old_first = head.next.load();
+        do
+        {
+            new_node->next.store(old_first, std::memory_order_relaxed);
+        } while (!head.next.compare_exchange_weak(old_first, new_node));
+    }
+
+    template <typename Function>
+    void for_each(Function f)
+    {
+        list_guard guard(*this);
+        node *cur = head.next.load();
+        while (cur)
+        {
+            node *const ne = cur->next.load();
+            if (!is_marked(ne))
+            {
+                f(static_cast<T const &>(*cur->data));
+            }
+            cur = get_unmarked(ne);
+        }
+    }
+
+    template <typename Predicate>
+    std::shared_ptr<T> find_first_if(Predicate p)
+    {
+        list_guard guard(*this);
+        node *cur = head.next.load();
+        while (cur)
+        {
+            node *const ne = cur->next.load();
+            if (!is_marked(ne) && p(static_cast<T const &>(*cur->data)))
+            {
+                return cur->data;
+            }
+            cur = get_unmarked(ne);
+        }
+        return std::shared_ptr<T>();
+    }
+
+    template <typename Predicate>
+    void remove_if(Predicate p)
+    {
+        list_guard guard(*this);
+        node *pred = &head;
+        node *cur = head.next.load();
+        while (cur)
+        {
+            node *ne = cur->next.load();
+            if (is_marked(ne))
+            {
+                if (!unlink(pred, cur, get_unmarked(ne)))
+                {
+                    pred = &head, cur = head.next.load();
+                    continue;
+                }
+                cur = get_unmarked(ne);
+                continue;
+            }
+            if (p(static_cast<T const &>(*cur->data)))
+            {
+                if (!cur->next.compare_exchange_strong(ne, get_marked(ne)))
+                {
+                    continue;
+                }
+                if (!unlink(pred, cur, ne))
+                {
+                    pred = &head, cur = head.next.load();
+                    continue;
+                }
+                cur = ne;
+                continue;
+            }
+            pred = cur, cur = ne;
+        }
+    }
+};
+
+int main()
+{
+    lock_free_list<int> test_list;
+    std::atomic<bool> pushing(true);
+    std::atomic<int> found(0);
+
+    std::thread t1([&]() {
+        for (int i = 1; i <= 20000; ++i)
+        {
+            test_list.push_front(i);
+        }
+        pushing.store(false);
+    });
+
+    std::thread t2([&]() {
+        while (pushing.load())
+        {
+            test_list.remove_if([](int const &value) { return value % 2 == 0; });
+        }
+        test_list.remove_if([](int const &value) { return value % 2 == 0; });
+    });
+
+    std::thread t3([&]() {
+        while (pushing.load())
+        {
+            if (test_list.find_first_if([](int const &value) { return value % 1000 == 999; }))
+            {
+                ++found;
+            }
+        }
+    });
+
+    std::thread t4([&]() {
+        while (pushing.load())
+        {
+            long long sum = 0;
+            test_list.for_each([&](int const &value) { sum += value; });
+        }
+    });
+
+    const auto start = std::chrono::steady_clock::now();
+    t1.join();
+    t2.join();
+    t3.join();
+    t4.join();
+    const auto end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double, std::milli> consumption = end - start;
+
+    int count = 0;
+    bool only_odd = true;
+    test_list.for_each([&](int const &value) {
+        ++count;
+        only_odd = only_odd && value % 2 == 1;
+    });
+    const auto scan_start = std::chrono::steady_clock::now();
+    auto last = test_list.find_first_if([](int const &value) { return value == 1; });
+    const auto scan_end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double, std::micro> scan_consumption = scan_end - scan_start;
+    std::cout << "Test lock_free_list " << (count == 10000 && only_odd && last && *last == 1 ? "successfully.\n" : "unsuccessfully.\n");
+    std::cout << "Full scan of " << count << " elements: " << scan_consumption.count() << "us.\n";
+    std::cout << "Total consuming times: " << consumption.count() << "ms.\n";
+
+    return 0;
+}
@@ -9,6 +9,48 @@
 #include <functional>
 #include <unordered_set>
 
+class eventcount
+{
+private:
+    std::atomic<unsigned int> epoch;
+    std::atomic<unsigned int> waiters;
+
+public:
+    eventcount() : epoch(0), waiters(0) {}
+
+    eventcount(eventcount const &other) = delete;
+
+    eventcount &operator=(eventcount const &other) = delete;
+
+    unsigned int prepare_wait()
+    {
+        waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_acquire);
+    }
+
+    void cancel_wait()
+    {
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void commit_wait(unsigned int key)
+    {
+        epoch.wait(key, std::memory_order_acquire);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify_one()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) != 0)
+        {
+            epoch.fetch_add(1, std::memory_order_release);
+            epoch.notify_one();
+        }
+    }
+};
+
 template <typename T>
 class lock_free_queue
 {
@@ -58,6 +100,7 @@ private:
     };
     std::atomic<counted_node_ptr> head;
     std::atomic<counted_node_ptr> tail;
+    eventcount data_event;
 
     void increase_external_count(std::atomic<counted_node_ptr> &counter, counted_node_ptr &old_counter)
     {
@@ -153,6 +196,7 @@ public:
                 set_new_tail(old_tail, old_next);
             }
         }
+        data_event.notify_one();
     }
 
     std::unique_ptr<T> pop()
@@ -178,6 +222,24 @@ public:
             ptr->release_ref();
         }
     }
+
+    std::unique_ptr<T> wait_pop()
+    {
+        for (;;)
+        {
+            if (std::unique_ptr<T> res = pop())
+            {
+                return res;
+            }
+            unsigned int const key = data_event.prepare_wait();
+            if (std::unique_ptr<T> res = pop())
+            {
+                data_event.cancel_wait();
+                return res;
+            }
+            data_event.commit_wait(key);
+        }
+    }
 };
 
 int main()
@@ -196,34 +258,42 @@ int main()
     });
 
     std::thread t2([&]() {
-        while (rmset.size() < 10)
+        for (;;)
         {
-            auto hd = test_queue.pop();
-            if (!hd)
+            auto hd = test_queue.wait_pop();
+            if (*hd == 0)
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
+                break;
             }
             std::lock_guard<std::mutex> lk(mtx);
             rmset.insert(*hd);
             std::string str = "Pop value: " + std::to_string(*hd) + " from lock_free_queue successfully.\n";
             std::cout << str;
+            if (rmset.size() == 10)
+            {
+                test_queue.push(0);
+                break;
+            }
         }
     });
 
     std::thread t3([&]() {
-        while (rmset.size() < 10)
+        for (;;)
         {
-            auto hd = test_queue.pop();
-            if (!hd)
+            auto hd = test_queue.wait_pop();
+            if (*hd == 0)
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
+                break;
             }
             std::lock_guard<std::mutex> lk(mtx);
             rmset.insert(*hd);
             std::string str = "Pop value: " + std::to_string(*hd) + " from lock_free_queue successfully.\n";
             std::cout << str;
+            if (rmset.size() == 10)
+            {
+                test_queue.push(0);
+                break;
+            }
         }
     });
 
@@ -7,21 +7,446 @@
 #include <list>
 #include <utility>
 #include <shared_mutex>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <future>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct bloom_filter_options
+{
+    bool enabled = false;
+    std::size_t expected_items = 1 << 16;
+    double false_positive_rate = 0.01;
+    double rebuild_ratio = 0.25;
+};
+
+struct bloom_filter_stats
+{
+    std::size_t bit_count;
+    unsigned int hash_count;
+    std::size_t memory_bytes;
+    std::size_t inserted_keys;
+    std::size_t removed_keys;
+    std::size_t rebuilds;
+    double target_false_positive_rate;
+    double estimated_false_positive_rate;
+};
+
+class concurrent_bloom_filter
+{
+private:
+    std::size_t bit_count;
+    unsigned int hash_count;
+    double rebuild_ratio;
+    double target_rate;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> bits[2];
+    std::atomic<int> active;
+    std::atomic<int> shadow;
+    std::atomic<unsigned int> generation;
+    std::atomic<std::size_t> inserted;
+    std::atomic<std::size_t> removed;
+    std::atomic<std::size_t> rebuilds;
+    std::mutex rebuild_mutex;
+
+    static std::uint64_t mix(std::uint64_t x)
+    {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    template <typename Function>
+    void for_each_bit(std::size_t hash, Function f) const
+    {
+        std::uint64_t const h1 = mix(hash);
+        std::uint64_t const h2 = mix(h1) | 1;
+        for (unsigned int i = 0; i < hash_count; ++i)
+        {
+            std::size_t const idx = (h1 + i * h2) % bit_count;
+            if (!f(idx >> 6, std::uint64_t(1) << (idx & 63)))
+            {
+                return;
+            }
+        }
+    }
+
+    void set_bits(std::atomic<std::uint64_t> *array, std::size_t hash)
+    {
+        for_each_bit(hash, [&](std::size_t word, std::uint64_t mask) {
+            if (!(array[word].load(std::memory_order_relaxed) & mask))
+            {
+                array[word].fetch_or(mask, std::memory_order_relaxed);
+            }
+            return true;
+        });
+    }
+
+public:
+    explicit concurrent_bloom_filter(bloom_filter_options const &options) : rebuild_ratio(options.rebuild_ratio), target_rate(options.false_positive_rate), active(0), shadow(-1), generation(0), inserted(0), removed(0), rebuilds(0)
+    {
+        double const items = static_cast<double>(std::max<std::size_t>(options.expected_items, 1));
+        double const rate = std::min(std::max(options.false_positive_rate, 1e-9), 0.5);
+        double const ln2 = std::log(2.0);
+        std::size_t const words = std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(-items * std::log(rate) / (ln2 * ln2) / 64)));
+        bit_count = words * 64;
+        hash_count = std::max(1u, static_cast<unsigned int>(std::lround(bit_count / items * ln2)));
+        for (auto &array : bits)
+        {
+            array.reset(new std::atomic<std::uint64_t>[words]);
+            for (std::size_t i = 0; i < words; ++i)
+            {
+                array[i].store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool may_contain(std::size_t hash) const
+    {
+        unsigned int const gen = generation.load(std::memory_order_acquire);
+        std::atomic<std::uint64_t> const *array = bits[active.load(std::memory_order_acquire)].get();
+        bool maybe = true;
+        for_each_bit(hash, [&](std::size_t word, std::uint64_t mask) {
+            return maybe = (array[word].load(std::memory_order_relaxed) & mask) != 0;
+        });
+        if (maybe)
+        {
+            return true;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return generation.load(std::memory_order_relaxed) != gen;
+    }
+
+    void insert(std::size_t hash)
+    {
+        int const pending = shadow.load();
+        int const current = active.load();
+        set_bits(bits[current].get(), hash);
+        if (pending >= 0 && pending != current)
+        {
+            set_bits(bits[pending].get(), hash);
+        }
+        inserted.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool note_removal(std::size_t n = 1)
+    {
+        std::size_t const count = removed.fetch_add(n, std::memory_order_relaxed) + n;
+        return count >= std::max<std::size_t>(1, static_cast<std::size_t>(rebuild_ratio * inserted.load(std::memory_order_relaxed)));
+    }
+
+    template <typename ForEachHash>
+    bool rebuild(ForEachHash for_each_hash, bool wait)
+    {
+        std::unique_lock<std::mutex> lk(rebuild_mutex, std::defer_lock);
+        if (wait)
+        {
+            lk.lock();
+        }
+        else if (!lk.try_lock())
+        {
+            return false;
+        }
+        int const target = 1 - active.load();
+        std::atomic<std::uint64_t> *array = bits[target].get();
+        generation.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (std::size_t i = 0; i < bit_count / 64; ++i)
+        {
+            array[i].store(0, std::memory_order_relaxed);
+        }
+        shadow.store(target);
+        std::size_t count = 0;
+        removed.store(0, std::memory_order_relaxed);
+        for_each_hash([&](std::size_t hash) {
+            set_bits(array, hash), ++count;
+        });
+        active.store(target);
+        shadow.store(-1);
+        generation.fetch_add(1, std::memory_order_release);
+        inserted.store(count, std::memory_order_relaxed);
+        rebuilds.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bloom_filter_stats stats() const
+    {
+        std::atomic<std::uint64_t> const *array = bits[active.load()].get();
+        std::size_t set = 0;
+        for (std::size_t i = 0; i < bit_count / 64; ++i)
+        {
+            set += __builtin_popcountll(array[i].load(std::memory_order_relaxed));
+        }
+        bloom_filter_stats res;
+        res.bit_count = bit_count;
+        res.hash_count = hash_count;
+        res.memory_bytes = 2 * bit_count / 8;
+        res.inserted_keys = inserted.load(std::memory_order_relaxed);
+        res.removed_keys = removed.load(std::memory_order_relaxed);
+        res.rebuilds = rebuilds.load(std::memory_order_relaxed);
+        res.target_false_positive_rate = target_rate;
+        res.estimated_false_positive_rate = std::pow(static_cast<double>(set) / bit_count, hash_count);
+        return res;
+    }
+};
+
+class mapped_snapshot
+{
+private:
+    void *addr;
+    std::size_t length;
+
+public:
+    explicit mapped_snapshot(std::string const &path) : addr(nullptr), length(0)
+    {
+        int const fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Cannot open snapshot " + path + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            int const err = errno;
+            ::close(fd);
+            throw std::runtime_error("Cannot stat snapshot " + path + ": " + std::strerror(err));
+        }
+        length = static_cast<std::size_t>(st.st_size);
+        if (length != 0)
+        {
+            addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        int const err = errno;
+        ::close(fd);
+        if (addr == MAP_FAILED)
+        {
+            throw std::runtime_error("Cannot map snapshot " + path + ": " + std::strerror(err));
+        }
+    }
+
+    mapped_snapshot(mapped_snapshot const &other) = delete;
+
+    mapped_snapshot &operator=(mapped_snapshot const &other) = delete;
+
+    ~mapped_snapshot()
+    {
+        if (addr)
+        {
+            ::munmap(addr, length);
+        }
+    }
+
+    char const *data() const
+    {
+        return static_cast<char const *>(addr);
+    }
+
+    std::size_t size() const
+    {
+        return length;
+    }
+};
+
+class snapshot_writer
+{
+private:
+    std::string path;
+    std::string tmp_path;
+    int fd;
+    std::vector<char> buffer;
+    std::size_t used;
+
+    void write_all(char const *p, std::size_t n)
+    {
+        while (n)
+        {
+            ssize_t const written = ::write(fd, p, n);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error("Cannot write snapshot " + tmp_path + ": " + std::strerror(errno));
+            }
+            p += written, n -= written;
+        }
+    }
+
+public:
+    explicit snapshot_writer(std::string const &_path) : path(_path), tmp_path(_path + ".tmp"), fd(-1), buffer(1 << 20), used(0)
+    {
+        fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Cannot create snapshot " + tmp_path + ": " + std::strerror(errno));
+        }
+    }
+
+    snapshot_writer(snapshot_writer const &other) = delete;
+
+    snapshot_writer &operator=(snapshot_writer const &other) = delete;
+
+    ~snapshot_writer()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+            ::unlink(tmp_path.c_str());
+        }
+    }
+
+    void write(void const *p, std::size_t n)
+    {
+        if (used + n > buffer.size())
+        {
+            flush();
+            if (n > buffer.size())
+            {
+                write_all(static_cast<char const *>(p), n);
+                return;
+            }
+        }
+        std::memcpy(buffer.data() + used, p, n);
+        used += n;
+    }
+
+    void flush()
+    {
+        write_all(buffer.data(), used);
+        used = 0;
+    }
+
+    void write_at(std::size_t offset, void const *p, std::size_t n)
+    {
+        flush();
+        if (::lseek(fd, static_cast<off_t>(offset), SEEK_SET) < 0)
+        {
+            throw std::runtime_error("Cannot seek snapshot " + tmp_path + ": " + std::strerror(errno));
+        }
+        write_all(static_cast<char const *>(p), n);
+        ::lseek(fd, 0, SEEK_END);
+    }
+
+    void commit()
+    {
+        flush();
+        if (::fsync(fd) != 0 || ::close(fd) != 0)
+        {
+            fd = -1;
+            ::unlink(tmp_path.c_str());
+            throw std::runtime_error("Cannot finish snapshot " + tmp_path + ": " + std::strerror(errno));
+        }
+        fd = -1;
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        {
+            ::unlink(tmp_path.c_str());
+            throw std::runtime_error("Cannot rename snapshot to " + path + ": " + std::strerror(errno));
+        }
+    }
+};
+
+struct snapshot_header
+{
+    char magic[8];
+    std::uint64_t version;
+    std::uint64_t bucket_count;
+    std::uint64_t entry_count;
+    std::uint64_t key_size;
+    std::uint64_t value_size;
+    std::uint64_t entry_size;
+    std::uint64_t data_offset;
+};
+
+class join_threads
+{
+private:
+    std::vector<std::thread> &ts;
+
+public:
+    explicit join_threads(std::vector<std::thread> &_ts) : ts(_ts) {}
+
+    ~join_threads()
+    {
+        for (auto &t : ts)
+        {
+            if (t.joinable())
+            {
+                t.join();
+            }
+        }
+    }
+};
 
 template <typename Key, typename Value, typename Hash = std::hash<Key>>
 class threadsafe_lookup_table
 {
 private:
+    using bucket_value = std::pair<Key, Value>;
+    using bucket_data = std::list<bucket_value>;
+
+    struct mapped_entry
+    {
+        Key key;
+        Value value;
+    };
+
     class bucket_type
     {
     private:
-        using bucket_value = std::pair<Key, Value>;
-        using bucket_data = std::list<bucket_value>;
         using bucket_iterator = typename bucket_data::iterator;
+        using bucket_const_iterator = typename bucket_data::const_iterator;
         bucket_data data;
+        std::shared_ptr<mapped_snapshot const> mapping;
+        mapped_entry const *mapped_first = nullptr;
+        mapped_entry const *mapped_last = nullptr;
         mutable std::shared_mutex mutex;
 
-        bucket_iterator find_entry_for(Key const &key) const
+        void materialize()
+        {
+            if (!mapping)
+            {
+                return;
+            }
+            for (mapped_entry const *p = mapped_first; p != mapped_last; ++p)
+            {
+                data.push_back(bucket_value(p->key, p->value));
+            }
+            mapping.reset();
+            mapped_first = mapped_last = nullptr;
+        }
+
+        mapped_entry const *find_mapped_entry_for(Key const &key) const
+        {
+            return std::find_if(mapped_first, mapped_last, [&](mapped_entry const &item) {
+                return item.key == key;
+            });
+        }
+
+        bucket_iterator find_entry_for(Key const &key)
+        {
+            return std::find_if(data.begin(), data.end(), [&](bucket_value const &item) {
+                return item.first == key;
+            });
+        }
+
+        bucket_const_iterator find_entry_for(Key const &key) const
         {
             return std::find_if(data.begin(), data.end(), [&](bucket_value const &item) {
                 return item.first == key;
@@ -32,48 +457,222 @@ private:
         Value value_for(Key const &key, Value const &default_value) const
         {
             std::shared_lock<std::shared_mutex> lock(mutex);
-            bucket_iterator const res = find_entry_for(key);
+            if (mapping)
+            {
+                mapped_entry const *const entry = find_mapped_entry_for(key);
+                return entry == mapped_last ? default_value : entry->value;
+            }
+            bucket_const_iterator const res = find_entry_for(key);
             return res == data.end() ? default_value : res->second;
         }
 
-        void add_or_update_mapping(Key const &key, Value const &value)
+        // on_new_key runs under the lock before a new key is stored, so nothing can see the key before it does.
+        template <typename Function>
+        void add_or_update_mapping(Key const &key, Value const &value, Function on_new_key)
         {
             std::unique_lock<std::shared_mutex> lock(mutex);
+            materialize();
             bucket_iterator const res = find_entry_for(key);
             if (res == data.end())
             {
+                on_new_key(key);
                 data.push_back(bucket_value(key, value));
                 return;
             }
             res->second = value;
         }
 
-        void remove_mapping(Key const &key)
+        bool remove_mapping(Key const &key)
         {
             std::unique_lock<std::shared_mutex> lock(mutex);
+            materialize();
             bucket_iterator const res = find_entry_for(key);
             if (res != data.end())
             {
                 data.erase(res);
+                return true;
+            }
+            return false;
+        }
+
+        template <typename Function>
+        void for_each(Function f) const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            for (mapped_entry const *p = mapped_first; p != mapped_last; ++p)
+            {
+                f(p->key, p->value);
+            }
+            for (auto const &item : data)
+            {
+                f(item.first, item.second);
             }
         }
+
+        void attach_mapping(std::shared_ptr<mapped_snapshot const> const &_mapping, mapped_entry const *first, mapped_entry const *last)
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            data.clear();
+            mapping = first != last ? _mapping : nullptr;
+            mapped_first = first, mapped_last = last;
+        }
+
+        template <typename Function>
+        void merge_entries(bucket_data &entries, Hash const &hasher, Function on_new_key)
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            materialize();
+            std::unordered_map<Key, bucket_iterator, Hash> index(data.size() + entries.size(), hasher);
+            for (auto it = data.begin(); it != data.end(); ++it)
+            {
+                index.emplace(it->first, it);
+            }
+            while (!entries.empty())
+            {
+                auto const found = index.find(entries.front().first);
+                if (found != index.end())
+                {
+                    found->second->second = std::move(entries.front().second);
+                    entries.pop_front();
+                    continue;
+                }
+                on_new_key(entries.front().first);
+                data.splice(data.end(), entries, entries.begin());
+                index.emplace(data.back().first, std::prev(data.end()));
+            }
+        }
+
+        std::size_t erase_entries(std::vector<Key> const &keys, Hash const &hasher)
+        {
+            std::unordered_set<Key, Hash> const doomed(keys.begin(), keys.end(), keys.size(), hasher);
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            materialize();
+            std::size_t const old_size = data.size();
+            data.remove_if([&](bucket_value const &item) {
+                return doomed.count(item.first) != 0;
+            });
+            return old_size - data.size();
+        }
     };
     Hash hasher;
     std::vector<std::unique_ptr<bucket_type>> buckets;
+    std::unique_ptr<concurrent_bloom_filter> filter;
+    std::mutex rebuild_launch_mutex;
+    std::future<void> pending_rebuild;
+
+    bucket_type &get_bucket(std::size_t hash) const
+    {
+        return *(buckets[hash % buckets.size()]);
+    }
+
+    std::size_t bulk_thread_count(std::size_t length) const
+    {
+        std::size_t const min_per_thread = 4096;
+        std::size_t const max_threads = std::min((length + min_per_thread - 1) / min_per_thread, buckets.size());
+        std::size_t const hardware_threads = std::thread::hardware_concurrency();
+        return std::max<std::size_t>(1, std::min<std::size_t>(hardware_threads != 0 ? hardware_threads : 2, max_threads));
+    }
+
+    template <typename Function>
+    static void run_workers(std::size_t num_threads, Function f)
+    {
+        std::vector<std::future<void>> fs(num_threads - 1);
+        std::vector<std::thread> ts(num_threads - 1);
+        {
+            join_threads joiners(ts);
+            for (std::size_t i = 0; i < num_threads - 1; ++i)
+            {
+                std::packaged_task<void(void)> task([&f, i]() { f(i + 1); });
+                fs[i] = task.get_future();
+                ts[i] = std::thread(std::move(task));
+            }
+            f(0);
+        }
+        for (auto &t : fs)
+        {
+            t.get();
+        }
+    }
+
+    template <typename ForwardIterator, typename Part, typename Function>
+    void partition_by_bucket(ForwardIterator first, std::size_t length, std::size_t num_threads, std::vector<std::vector<Part>> &parts, Function add_to_part) const
+    {
+        std::vector<ForwardIterator> block_starts(num_threads + 1, first);
+        std::size_t const block_size = length / num_threads;
+        for (std::size_t i = 1; i < num_threads; ++i)
+        {
+            block_starts[i] = block_starts[i - 1];
+            std::advance(block_starts[i], block_size);
+        }
+        block_starts[num_threads] = block_starts[num_threads - 1];
+        std::advance(block_starts[num_threads], length - block_size * (num_threads - 1));
+        run_workers(num_threads, [&](std::size_t worker) {
+            std::vector<Part> &part = parts[worker];
+            part.resize(buckets.size());
+            for (ForwardIterator it = block_starts[worker]; it != block_starts[worker + 1]; ++it)
+            {
+                add_to_part(part, *it);
+            }
+        });
+    }
+
+    template <typename Function>
+    void for_each_owned_bucket(std::size_t num_threads, Function f)
+    {
+        run_workers(num_threads, [&](std::size_t worker) {
+            std::size_t const bucket_first = buckets.size() * worker / num_threads;
+            std::size_t const bucket_last = buckets.size() * (worker + 1) / num_threads;
+            for (std::size_t idx = bucket_first; idx < bucket_last; ++idx)
+            {
+                f(idx);
+            }
+        });
+    }
 
-    bucket_type &get_bucket(Key const &key) const
+    bool rebuild_filter(bool wait)
     {
-        std::size_t const idx = hasher(key) % buckets.size();
-        return *(buckets[idx]);
+        return filter->rebuild([&](auto add_hash) {
+            for (auto const &bucket : buckets)
+            {
+                bucket->for_each([&](Key const &key, Value const &) {
+                    add_hash(hasher(key));
+                });
+            }
+        }, wait);
+    }
+
+    // Rebuilding scans the whole table, so removals hand it to a background task instead of paying for it themselves.
+    // At most one is in flight; removals that cross the threshold meanwhile are covered by the running rebuild or the next one.
+    void schedule_filter_rebuild()
+    {
+        std::lock_guard<std::mutex> lk(rebuild_launch_mutex);
+        if (pending_rebuild.valid() && pending_rebuild.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            return;
+        }
+        pending_rebuild = std::async(std::launch::async, [this] { rebuild_filter(true); });
     }
 
 public:
-    threadsafe_lookup_table(int nums = 19, Hash const &_hasher = Hash()) : buckets(nums), hasher(_hasher)
+    threadsafe_lookup_table(int nums = 19, Hash const &_hasher = Hash(), bloom_filter_options const &filter_options = bloom_filter_options()) : hasher(_hasher), buckets(nums)
     {
         for (int i = 0; i < nums; ++i)
         {
             buckets[i].reset(new bucket_type);
         }
+        if (filter_options.enabled)
+        {
+            filter.reset(new concurrent_bloom_filter(filter_options));
+        }
+    }
+
+    ~threadsafe_lookup_table()
+    {
+        std::lock_guard<std::mutex> lk(rebuild_launch_mutex);
+        if (pending_rebuild.valid())
+        {
+            pending_rebuild.wait();
+        }
     }
 
     threadsafe_lookup_table(threadsafe_lookup_table const &other) = delete;
@@ -82,17 +681,215 @@ public:
 
     Value value_for(Key const &key, Value const &default_value = Value()) const
     {
-        return get_bucket(key).value_for(key, default_value);
+        std::size_t const hash = hasher(key);
+        if (filter && !filter->may_contain(hash))
+        {
+            return default_value;
+        }
+        return get_bucket(hash).value_for(key, default_value);
     }
 
     void add_or_update_mapping(Key const &key, Value const &value)
     {
-        get_bucket(key).add_or_update_mapping(key, value);
+        std::size_t const hash = hasher(key);
+        get_bucket(hash).add_or_update_mapping(key, value, [&](Key const &) {
+            if (filter)
+            {
+                filter->insert(hash);
+            }
+        });
     }
 
+    // Removed keys stay in the filter until a rebuild, which is scheduled in the background once enough have piled up.
     void remove_mapping(Key const &key)
     {
-        get_bucket(key).remove_mapping(key);
+        std::size_t const hash = hasher(key);
+        if (get_bucket(hash).remove_mapping(key) && filter && filter->note_removal())
+        {
+            schedule_filter_rebuild();
+        }
+    }
+
+    template <typename ForwardIterator>
+    void bulk_insert(ForwardIterator first, ForwardIterator last)
+    {
+        std::size_t const length = std::distance(first, last);
+        if (length == 0)
+        {
+            return;
+        }
+        std::size_t const num_threads = bulk_thread_count(length);
+        std::vector<std::vector<bucket_data>> parts(num_threads);
+        partition_by_bucket(first, length, num_threads, parts, [&](std::vector<bucket_data> &part, bucket_value const &item) {
+            part[hasher(item.first) % buckets.size()].push_back(item);
+        });
+        for_each_owned_bucket(num_threads, [&](std::size_t idx) {
+            bucket_data entries;
+            for (auto &part : parts)
+            {
+                entries.splice(entries.end(), part[idx]);
+            }
+            if (entries.empty())
+            {
+                return;
+            }
+            buckets[idx]->merge_entries(entries, hasher, [&](Key const &key) {
+                if (filter)
+                {
+                    filter->insert(hasher(key));
+                }
+            });
+        });
+    }
+
+    template <typename ForwardIterator>
+    void bulk_erase(ForwardIterator first, ForwardIterator last)
+    {
+        std::size_t const length = std::distance(first, last);
+        if (length == 0)
+        {
+            return;
+        }
+        std::size_t const num_threads = bulk_thread_count(length);
+        std::vector<std::vector<std::vector<Key>>> parts(num_threads);
+        partition_by_bucket(first, length, num_threads, parts, [&](std::vector<std::vector<Key>> &part, Key const &key) {
+            part[hasher(key) % buckets.size()].push_back(key);
+        });
+        std::atomic<std::size_t> removed(0);
+        for_each_owned_bucket(num_threads, [&](std::size_t idx) {
+            std::vector<Key> keys;
+            for (auto &part : parts)
+            {
+                keys.insert(keys.end(), part[idx].begin(), part[idx].end());
+            }
+            if (!keys.empty())
+            {
+                removed += buckets[idx]->erase_entries(keys, hasher);
+            }
+        });
+        if (filter && removed.load() && filter->note_removal(removed.load()))
+        {
+            schedule_filter_rebuild();
+        }
+    }
+
+    void save_snapshot(std::string const &path) const
+    {
+        static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value, "snapshots need trivially copyable keys and values");
+        std::uint64_t const bucket_count = buckets.size();
+        std::uint64_t const header_size = sizeof(snapshot_header) + (bucket_count + 1) * sizeof(std::uint64_t);
+        std::uint64_t const alignment = std::max<std::uint64_t>(alignof(mapped_entry), 64);
+        snapshot_header header;
+        std::memcpy(header.magic, "TSLTSNAP", sizeof(header.magic));
+        header.version = 1;
+        header.bucket_count = bucket_count;
+        header.key_size = sizeof(Key);
+        header.value_size = sizeof(Value);
+        header.entry_size = sizeof(mapped_entry);
+        header.data_offset = (header_size + alignment - 1) / alignment * alignment;
+
+        snapshot_writer out(path);
+        std::vector<char> padding(header.data_offset, 0);
+        out.write(padding.data(), padding.size());
+        std::vector<std::uint64_t> offsets(bucket_count + 1, 0);
+        std::uint64_t count = 0;
+        for (std::uint64_t i = 0; i < bucket_count; ++i)
+        {
+            offsets[i] = count;
+            buckets[i]->for_each([&](Key const &key, Value const &value) {
+                mapped_entry entry;
+                std::memset(static_cast<void *>(&entry), 0, sizeof(entry));
+                entry.key = key, entry.value = value;
+                out.write(&entry, sizeof(entry));
+                ++count;
+            });
+        }
+        offsets[bucket_count] = count;
+        header.entry_count = count;
+        out.write_at(0, &header, sizeof(header));
+        out.write_at(sizeof(header), offsets.data(), offsets.size() * sizeof(std::uint64_t));
+        out.commit();
+    }
+
+    void load_snapshot(std::string const &path)
+    {
+        static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value, "snapshots need trivially copyable keys and values");
+        auto const mapping = std::make_shared<mapped_snapshot const>(path);
+        snapshot_header header;
+        if (mapping->size() < sizeof(header))
+        {
+            throw std::runtime_error("Snapshot " + path + " is truncated");
+        }
+        std::memcpy(&header, mapping->data(), sizeof(header));
+        if (std::memcmp(header.magic, "TSLTSNAP", sizeof(header.magic)) != 0 || header.version != 1 || header.key_size != sizeof(Key) || header.value_size != sizeof(Value) || header.entry_size != sizeof(mapped_entry) || header.data_offset % alignof(mapped_entry) != 0)
+        {
+            throw std::runtime_error("Snapshot " + path + " does not match this table type");
+        }
+        // bucket_count + 1 offsets must fit after the header; checked before multiplying so a corrupt count cannot wrap.
+        if (header.bucket_count >= (mapping->size() - sizeof(header)) / sizeof(std::uint64_t))
+        {
+            throw std::runtime_error("Snapshot " + path + " is truncated");
+        }
+        if (header.data_offset < sizeof(header) + (header.bucket_count + 1) * sizeof(std::uint64_t) || header.data_offset > mapping->size() || (mapping->size() - header.data_offset) / sizeof(mapped_entry) < header.entry_count)
+        {
+            throw std::runtime_error("Snapshot " + path + " is truncated");
+        }
+        std::uint64_t const *offsets = reinterpret_cast<std::uint64_t const *>(mapping->data() + sizeof(header));
+        for (std::uint64_t i = 0; i < header.bucket_count; ++i)
+        {
+            if (offsets[i] > offsets[i + 1])
+            {
+                throw std::runtime_error("Snapshot " + path + " is corrupted");
+            }
+        }
+        if (offsets[0] != 0 || offsets[header.bucket_count] != header.entry_count)
+        {
+            throw std::runtime_error("Snapshot " + path + " is corrupted");
+        }
+        mapped_entry const *entries = reinterpret_cast<mapped_entry const *>(mapping->data() + header.data_offset);
+        if (header.bucket_count == buckets.size())
+        {
+            for (std::size_t i = 0; i < buckets.size(); ++i)
+            {
+                buckets[i]->attach_mapping(mapping, entries + offsets[i], entries + offsets[i + 1]);
+            }
+        }
+        else
+        {
+            for (auto &bucket : buckets)
+            {
+                bucket->attach_mapping(nullptr, nullptr, nullptr);
+            }
+            std::vector<bucket_value> staging;
+            staging.reserve(header.entry_count);
+            for (std::uint64_t i = 0; i < header.entry_count; ++i)
+            {
+                staging.emplace_back(entries[i].key, entries[i].value);
+            }
+            bulk_insert(staging.begin(), staging.end());
+        }
+        if (filter)
+        {
+            rebuild_filter(true);
+        }
+    }
+
+    void rebuild_filter()
+    {
+        if (filter)
+        {
+            rebuild_filter(true);
+        }
+    }
+
+    bool has_filter() const
+    {
+        return filter != nullptr;
+    }
+
+    bloom_filter_stats filter_stats() const
+    {
+        return filter ? filter->stats() : bloom_filter_stats();
     }
 
     std::map<Key, Value> get_map() const
@@ -118,5 +915,92 @@ int main()
 {
     threadsafe_lookup_table<int, int> test_table;
 
+    bloom_filter_options options;
+    options.enabled = true;
+    options.expected_items = 100000;
+    options.false_positive_rate = 0.01;
+    threadsafe_lookup_table<int, int> filtered_table(1031, std::hash<int>(), options);
+
+    std::thread t1([&]() {
+        for (int i = 0; i < 100000; i += 2)
+        {
+            filtered_table.add_or_update_mapping(i, i);
+        }
+    });
+
+    std::thread t2([&]() {
+        for (int i = 1; i < 100000; i += 2)
+        {
+            filtered_table.add_or_update_mapping(i, i);
+        }
+    });
+    t1.join();
+    t2.join();
+
+    for (int i = 0; i < 100000; i += 4)
+    {
+        filtered_table.remove_mapping(i);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    int wrong = 0;
+    for (int i = 0; i < 200000; ++i)
+    {
+        int const expected = (i < 100000 && i % 4 != 0) ? i : -1;
+        wrong += filtered_table.value_for(i, -1) != expected;
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double, std::milli> consumption = end - start;
+
+    bloom_filter_stats const stats = filtered_table.filter_stats();
+    std::cout << "Bloom filter bits: " << stats.bit_count << ", hashes: " << stats.hash_count << ", memory: " << stats.memory_bytes << " bytes.\n";
+    std::cout << "Bloom filter keys: " << stats.inserted_keys << ", rebuilds: " << stats.rebuilds << ", estimated false positive rate: " << stats.estimated_false_positive_rate << ".\n";
+    std::cout << "Test threadsafe_lookup_table with bloom filter " << (wrong == 0 ? "successfully.\n" : "unsuccessfully.\n");
+    std::cout << "Total consuming times: " << consumption.count() << "ms.\n";
+
+    std::vector<std::pair<int, int>> entries;
+    for (int i = 0; i < 1000000; ++i)
+    {
+        entries.emplace_back(i, i * 2);
+    }
+    threadsafe_lookup_table<int, int> bulk_table(100003);
+    const auto bulk_start = std::chrono::steady_clock::now();
+    bulk_table.bulk_insert(entries.begin(), entries.end());
+    const auto bulk_end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double, std::milli> bulk_consumption = bulk_end - bulk_start;
+
+    std::vector<int> doomed_keys;
+    for (int i = 0; i < 1000000; i += 2)
+    {
+        doomed_keys.push_back(i);
+    }
+    bulk_table.bulk_erase(doomed_keys.begin(), doomed_keys.end());
+    int bulk_wrong = 0;
+    for (int i = 0; i < 1000000; ++i)
+    {
+        bulk_wrong += bulk_table.value_for(i, -1) != (i % 2 ? i * 2 : -1);
+    }
+    std::cout << "Test threadsafe_lookup_table bulk_insert and bulk_erase " << (bulk_wrong == 0 ? "successfully.\n" : "unsuccessfully.\n");
+    std::cout << "Bulk insert consuming times: " << bulk_consumption.count() << "ms.\n";
+
+    std::string const snapshot_path = "/tmp/threadsafe_lookup_table.snapshot";
+    bulk_table.save_snapshot(snapshot_path);
+    threadsafe_lookup_table<int, int> warm_table(100003);
+    const auto load_start = std::chrono::steady_clock::now();
+    warm_table.load_snapshot(snapshot_path);
+    const auto load_end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double, std::milli> load_consumption = load_end - load_start;
+    warm_table.add_or_update_mapping(1, -1);
+    warm_table.remove_mapping(3);
+    int warm_wrong = 0;
+    for (int i = 0; i < 1000000; ++i)
+    {
+        int const expected = i == 1 ? -1 : (i % 2 && i != 3 ? i * 2 : -2);
+        warm_wrong += warm_table.value_for(i, -2) != expected;
+    }
+    std::remove(snapshot_path.c_str());
+    std::cout << "Test threadsafe_lookup_table save_snapshot and load_snapshot " << (warm_wrong == 0 ? "successfully.\n" : "unsuccessfully.\n");
+    std::cout << "Snapshot load consuming times: " << load_consumption.count() << "ms.\n";
+
     return 0;
 }
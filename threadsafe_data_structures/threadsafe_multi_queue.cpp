@@ -0,0 +1,396 @@
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <deque>
+#include <queue>
+#include <random>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <algorithm>
+
+class eventcount
+{
+private:
+    std::atomic<unsigned int> epoch;
+    std::atomic<unsigned int> waiters;
+
+public:
+    eventcount() : epoch(0), waiters(0) {}
+
+    eventcount(eventcount const &other) = delete;
+
+    eventcount &operator=(eventcount const &other) = delete;
+
+    unsigned int prepare_wait()
+    {
+        waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_acquire);
+    }
+
+    void cancel_wait()
+    {
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void commit_wait(unsigned int key)
+    {
+        epoch.wait(key, std::memory_order_acquire);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify_one()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) != 0)
+        {
+            epoch.fetch_add(1, std::memory_order_release);
+            epoch.notify_one();
+        }
+    }
+};
+
+template <typename T>
+class threadsafe_multi_queue
+{
+private:
+    using stamp_type = std::chrono::steady_clock::rep;
+    static constexpr stamp_type empty_stamp = std::numeric_limits<stamp_type>::max();
+    static constexpr unsigned int home_stickiness = 8;
+
+    struct alignas(64) shard
+    {
+        std::mutex mtx;
+        std::deque<std::pair<stamp_type, std::shared_ptr<T>>> items;
+        std::atomic<stamp_type> front_stamp;
+
+        shard() : front_stamp(empty_stamp) {}
+
+        void push_locked(stamp_type stamp, std::shared_ptr<T> data)
+        {
+            if (items.empty())
+            {
+                front_stamp.store(stamp, std::memory_order_relaxed);
+            }
+            items.emplace_back(stamp, std::move(data));
+        }
+
+        std::shared_ptr<T> pop_locked()
+        {
+            std::shared_ptr<T> res(std::move(items.front().second));
+            items.pop_front();
+            front_stamp.store(items.empty() ? empty_stamp : items.front().first, std::memory_order_relaxed);
+            return res;
+        }
+    };
+    std::size_t const shard_count;
+    std::unique_ptr<shard[]> shards;
+    eventcount data_event;
+
+    static std::mt19937 &generator()
+    {
+        thread_local std::mt19937 gen(std::random_device{}());
+        return gen;
+    }
+
+    std::size_t random_shard()
+    {
+        return generator()() % shard_count;
+    }
+
+    // A thread keeps its home shard for home_stickiness pushes and then rerolls it. A shard fed by a fixed set of
+    // producers would fall further behind the others the longer it ran, and the pops' rank error would grow with it.
+    std::size_t home_shard()
+    {
+        thread_local std::size_t sticky = 0;
+        thread_local unsigned int uses = 0;
+        if (uses++ % home_stickiness == 0)
+        {
+            sticky = generator()();
+        }
+        return sticky % shard_count;
+    }
+
+    static stamp_type now()
+    {
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+
+    std::shared_ptr<T> pop_relaxed()
+    {
+        for (std::size_t attempt = 0; attempt < shard_count; ++attempt)
+        {
+            std::size_t const first = random_shard(), second = random_shard();
+            stamp_type const first_stamp = shards[first].front_stamp.load(std::memory_order_relaxed);
+            stamp_type const second_stamp = shards[second].front_stamp.load(std::memory_order_relaxed);
+            shard &best = shards[first_stamp <= second_stamp ? first : second];
+            if (std::min(first_stamp, second_stamp) == empty_stamp)
+            {
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(best.mtx, std::try_to_lock);
+            if (lk.owns_lock() && !best.items.empty())
+            {
+                return best.pop_locked();
+            }
+        }
+        for (std::size_t i = 0; i < shard_count; ++i)
+        {
+            std::lock_guard<std::mutex> lk(shards[i].mtx);
+            if (!shards[i].items.empty())
+            {
+                return shards[i].pop_locked();
+            }
+        }
+        return std::shared_ptr<T>();
+    }
+
+public:
+    explicit threadsafe_multi_queue(std::size_t _shard_count = 2 * std::max(1u, std::thread::hardware_concurrency())) : shard_count(std::max<std::size_t>(1, _shard_count)), shards(new shard[shard_count]) {}
+
+    threadsafe_multi_queue(threadsafe_multi_queue const &other) = delete;
+
+    threadsafe_multi_queue &operator=(threadsafe_multi_queue const &other) = delete;
+
+    std::size_t shards_size() const
+    {
+        return shard_count;
+    }
+
+    void push(T new_value)
+    {
+        std::shared_ptr<T> data(std::make_shared<T>(std::move(new_value)));
+        shard &home = shards[home_shard()];
+        std::unique_lock<std::mutex> lk(home.mtx, std::try_to_lock);
+        if (lk.owns_lock())
+        {
+            home.push_locked(now(), std::move(data));
+        }
+        else
+        {
+            shard &other = shards[random_shard()];
+            std::unique_lock<std::mutex> other_lk(other.mtx, std::try_to_lock);
+            if (other_lk.owns_lock())
+            {
+                other.push_locked(now(), std::move(data));
+            }
+            else
+            {
+                lk.lock();
+                home.push_locked(now(), std::move(data));
+            }
+        }
+        data_event.notify_one();
+    }
+
+    bool try_pop(T &value)
+    {
+        std::shared_ptr<T> const res = pop_relaxed();
+        if (!res)
+        {
+            return false;
+        }
+        value = std::move(*res);
+        return true;
+    }
+
+    std::shared_ptr<T> try_pop()
+    {
+        return pop_relaxed();
+    }
+
+    std::shared_ptr<T> wait_and_pop()
+    {
+        for (;;)
+        {
+            if (std::shared_ptr<T> res = pop_relaxed())
+            {
+                return res;
+            }
+            unsigned int const key = data_event.prepare_wait();
+            if (std::shared_ptr<T> res = pop_relaxed())
+            {
+                data_event.cancel_wait();
+                return res;
+            }
+            data_event.commit_wait(key);
+        }
+    }
+
+    void wait_and_pop(T &value)
+    {
+        value = std::move(*wait_and_pop());
+    }
+
+    bool empty() const
+    {
+        for (std::size_t i = 0; i < shard_count; ++i)
+        {
+            if (shards[i].front_stamp.load(std::memory_order_relaxed) != empty_stamp)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+template <typename T>
+class locked_queue
+{
+private:
+    std::mutex mtx;
+    std::queue<std::shared_ptr<T>> items;
+
+public:
+    void push(T new_value)
+    {
+        std::shared_ptr<T> data(std::make_shared<T>(std::move(new_value)));
+        std::lock_guard<std::mutex> lk(mtx);
+        items.push(std::move(data));
+    }
+
+    bool try_pop(T &value)
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (items.empty())
+        {
+            return false;
+        }
+        value = std::move(*items.front());
+        items.pop();
+        return true;
+    }
+};
+
+template <typename Queue>
+double measure_throughput(Queue &queue, unsigned int thread_pairs, int items_per_producer, bool &success)
+{
+    std::atomic<long long> consumed_sum(0);
+    std::atomic<int> consumed_count(0);
+    int const total = static_cast<int>(thread_pairs) * items_per_producer;
+    std::vector<std::thread> threads;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int t = 0; t < thread_pairs; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < items_per_producer; ++i)
+            {
+                queue.push(static_cast<int>(t) * items_per_producer + i + 1);
+            }
+        });
+        threads.emplace_back([&]() {
+            int value;
+            long long local_sum = 0;
+            while (consumed_count.load(std::memory_order_relaxed) < total)
+            {
+                if (queue.try_pop(value))
+                {
+                    local_sum += value;
+                    consumed_count.fetch_add(1, std::memory_order_relaxed);
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+            consumed_sum += local_sum;
+        });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> consumption = end - start;
+
+    success = success && consumed_sum.load() == 1LL * total * (total + 1) / 2 && consumed_count.load() == total;
+    return 2.0 * total / consumption.count() / 1e6;
+}
+
+int main()
+{
+    // Producers take strict turns, so push order is the ticket order and every item's stamp is in that order too,
+    // while the items are spread over each producer's home shards. The rank error of a pop is how many smaller tickets
+    // were still queued; with sticky runs of 8 pushes over 8 shards it stays in the hundreds, far below the 10000 items.
+    threadsafe_multi_queue<int> ordering_queue(8);
+    constexpr int ordering_items = 10000;
+    constexpr unsigned int ordering_producers = 8;
+    std::mutex turn_mutex;
+    std::condition_variable turn_cond;
+    int next_ticket = 0;
+    std::vector<std::thread> producers;
+    for (unsigned int t = 0; t < ordering_producers; ++t)
+    {
+        producers.emplace_back([&, t]() {
+            std::unique_lock<std::mutex> turn_lock(turn_mutex);
+            for (;;)
+            {
+                turn_cond.wait(turn_lock, [&] { return next_ticket == ordering_items || next_ticket % ordering_producers == t; });
+                if (next_ticket == ordering_items)
+                {
+                    return;
+                }
+                ordering_queue.push(next_ticket++);
+                turn_cond.notify_all();
+            }
+        });
+    }
+    for (auto &t : producers)
+    {
+        t.join();
+    }
+    std::vector<char> popped(ordering_items, 0);
+    int lowest_queued = 0, max_rank_error = 0;
+    for (int i = 0; i < ordering_items; ++i)
+    {
+        int const value = *ordering_queue.try_pop();
+        max_rank_error = std::max(max_rank_error, static_cast<int>(std::count(popped.begin() + lowest_queued, popped.begin() + value, 0)));
+        popped[value] = 1;
+        while (lowest_queued < ordering_items && popped[lowest_queued])
+        {
+            ++lowest_queued;
+        }
+    }
+    bool const ordering_ok = max_rank_error <= 256 * static_cast<int>(ordering_queue.shards_size());
+
+    threadsafe_multi_queue<int> blocking_queue;
+    long long blocking_sum = 0;
+    std::thread consumer([&]() {
+        for (int i = 0; i < 1000; ++i)
+        {
+            blocking_sum += *blocking_queue.wait_and_pop();
+        }
+    });
+    std::thread producer([&]() {
+        for (int i = 1; i <= 1000; ++i)
+        {
+            blocking_queue.push(i);
+        }
+    });
+    producer.join();
+    consumer.join();
+
+    bool success = ordering_ok && ordering_queue.empty() && blocking_sum == 500500 && blocking_queue.empty();
+    unsigned int const max_pairs = std::max(2u, std::thread::hardware_concurrency());
+    for (unsigned int pairs = 1; pairs <= max_pairs; pairs *= 2)
+    {
+        threadsafe_multi_queue<int> multi_queue;
+        locked_queue<int> single_queue;
+        double const multi_rate = measure_throughput(multi_queue, pairs, 100000, success);
+        double const single_rate = measure_throughput(single_queue, pairs, 100000, success);
+        std::cout << pairs << " producer/consumer pairs: threadsafe_multi_queue " << multi_rate << " Mops/s, single locked queue " << single_rate << " Mops/s.\n";
+    }
+    std::cout << "Test threadsafe_multi_queue " << (success ? "successfully.\n" : "unsuccessfully.\n");
+    std::cout << "Shards: " << ordering_queue.shards_size() << ", max rank error: " << max_rank_error << ".\n";
+
+    return 0;
+}
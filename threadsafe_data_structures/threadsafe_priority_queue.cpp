@@ -0,0 +1,371 @@
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <optional>
+#include <chrono>
+#include <atomic>
+#include <queue>
+#include <random>
+#include <limits>
+#include <cmath>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+
+class eventcount
+{
+private:
+    std::atomic<unsigned int> epoch;
+    std::atomic<unsigned int> waiters;
+
+public:
+    eventcount() : epoch(0), waiters(0) {}
+
+    eventcount(eventcount const &other) = delete;
+
+    eventcount &operator=(eventcount const &other) = delete;
+
+    unsigned int prepare_wait()
+    {
+        waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_acquire);
+    }
+
+    void cancel_wait()
+    {
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void commit_wait(unsigned int key)
+    {
+        epoch.wait(key, std::memory_order_acquire);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify_one()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) != 0)
+        {
+            epoch.fetch_add(1, std::memory_order_release);
+            epoch.notify_one();
+        }
+    }
+};
+
+template <typename Priority, typename T>
+class threadsafe_priority_queue
+{
+    static_assert(std::is_arithmetic<Priority>::value, "Priority must be an arithmetic type");
+
+public:
+    using value_type = std::pair<Priority, T>;
+
+private:
+    struct later
+    {
+        bool operator()(value_type const &lhs, value_type const &rhs) const
+        {
+            return rhs.first < lhs.first;
+        }
+    };
+
+    struct alignas(64) heap
+    {
+        std::mutex mtx;
+        std::priority_queue<value_type, std::vector<value_type>, later> items;
+        std::atomic<Priority> top_priority;
+        std::atomic<bool> has_items;
+
+        heap() : top_priority(std::numeric_limits<Priority>::max()), has_items(false) {}
+
+        void refresh_top()
+        {
+            has_items.store(!items.empty(), std::memory_order_relaxed);
+            if (!items.empty())
+            {
+                top_priority.store(items.top().first, std::memory_order_relaxed);
+            }
+        }
+
+        void push_locked(Priority priority, T &&item)
+        {
+            items.emplace(priority, std::move(item));
+            refresh_top();
+        }
+
+        value_type pop_locked()
+        {
+            value_type res(std::move(const_cast<value_type &>(items.top())));
+            items.pop();
+            refresh_top();
+            return res;
+        }
+    };
+    std::size_t const heap_count;
+    std::unique_ptr<heap[]> heaps;
+    eventcount data_event;
+
+    static std::mt19937 &generator()
+    {
+        thread_local std::mt19937 gen(std::random_device{}());
+        return gen;
+    }
+
+    std::size_t random_heap()
+    {
+        return generator()() % heap_count;
+    }
+
+    std::optional<value_type> pop_relaxed()
+    {
+        for (std::size_t attempt = 0; attempt < heap_count; ++attempt)
+        {
+            std::size_t const first = random_heap(), second = random_heap();
+            bool const first_ready = heaps[first].has_items.load(std::memory_order_relaxed);
+            bool const second_ready = heaps[second].has_items.load(std::memory_order_relaxed);
+            if (!first_ready && !second_ready)
+            {
+                continue;
+            }
+            std::size_t best = first_ready ? first : second;
+            if (first_ready && second_ready && heaps[second].top_priority.load(std::memory_order_relaxed) < heaps[first].top_priority.load(std::memory_order_relaxed))
+            {
+                best = second;
+            }
+            std::unique_lock<std::mutex> lk(heaps[best].mtx, std::try_to_lock);
+            if (lk.owns_lock() && !heaps[best].items.empty())
+            {
+                return heaps[best].pop_locked();
+            }
+        }
+        for (std::size_t i = 0; i < heap_count; ++i)
+        {
+            std::lock_guard<std::mutex> lk(heaps[i].mtx);
+            if (!heaps[i].items.empty())
+            {
+                return heaps[i].pop_locked();
+            }
+        }
+        return std::nullopt;
+    }
+
+public:
+    explicit threadsafe_priority_queue(std::size_t _heap_count = 2 * std::max(1u, std::thread::hardware_concurrency())) : heap_count(std::max<std::size_t>(1, _heap_count)), heaps(new heap[heap_count]) {}
+
+    threadsafe_priority_queue(threadsafe_priority_queue const &other) = delete;
+
+    threadsafe_priority_queue &operator=(threadsafe_priority_queue const &other) = delete;
+
+    std::size_t heaps_size() const
+    {
+        return heap_count;
+    }
+
+    void push(Priority priority, T item)
+    {
+        heap &first = heaps[random_heap()];
+        std::unique_lock<std::mutex> lk(first.mtx, std::try_to_lock);
+        if (lk.owns_lock())
+        {
+            first.push_locked(priority, std::move(item));
+        }
+        else
+        {
+            heap &second = heaps[random_heap()];
+            std::unique_lock<std::mutex> second_lk(second.mtx, std::try_to_lock);
+            if (!second_lk.owns_lock())
+            {
+                second_lk.lock();
+            }
+            second.push_locked(priority, std::move(item));
+        }
+        data_event.notify_one();
+    }
+
+    bool try_pop_min(value_type &value)
+    {
+        std::optional<value_type> res = pop_relaxed();
+        if (!res)
+        {
+            return false;
+        }
+        value = std::move(*res);
+        return true;
+    }
+
+    std::shared_ptr<value_type> try_pop_min()
+    {
+        std::optional<value_type> res = pop_relaxed();
+        return res ? std::make_shared<value_type>(std::move(*res)) : std::shared_ptr<value_type>();
+    }
+
+    std::shared_ptr<value_type> wait_pop_min()
+    {
+        for (;;)
+        {
+            if (std::optional<value_type> res = pop_relaxed())
+            {
+                return std::make_shared<value_type>(std::move(*res));
+            }
+            unsigned int const key = data_event.prepare_wait();
+            if (std::optional<value_type> res = pop_relaxed())
+            {
+                data_event.cancel_wait();
+                return std::make_shared<value_type>(std::move(*res));
+            }
+            data_event.commit_wait(key);
+        }
+    }
+
+    void wait_pop_min(value_type &value)
+    {
+        value = std::move(*wait_pop_min());
+    }
+
+    bool empty() const
+    {
+        for (std::size_t i = 0; i < heap_count; ++i)
+        {
+            if (heaps[i].has_items.load(std::memory_order_relaxed))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+template <typename Priority, typename T>
+class locked_priority_queue
+{
+public:
+    using value_type = std::pair<Priority, T>;
+
+private:
+    std::mutex mtx;
+    std::priority_queue<value_type, std::vector<value_type>, std::greater<value_type>> items;
+
+public:
+    void push(Priority priority, T item)
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        items.emplace(priority, std::move(item));
+    }
+
+    bool try_pop_min(value_type &value)
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (items.empty())
+        {
+            return false;
+        }
+        value = items.top();
+        items.pop();
+        return true;
+    }
+};
+
+template <typename Queue>
+double measure_throughput(Queue &queue, unsigned int thread_count, int ops_per_thread, bool &success)
+{
+    std::atomic<long long> pushed_sum(0), popped_sum(0);
+    std::vector<std::thread> threads;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int t = 0; t < thread_count; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            std::mt19937 gen(t);
+            typename Queue::value_type value;
+            long long local_pushed = 0, local_popped = 0;
+            for (int i = 0; i < ops_per_thread; ++i)
+            {
+                int const item = static_cast<int>(gen() % 1000);
+                queue.push(static_cast<int>(gen() % 100000), item);
+                local_pushed += item;
+                if (queue.try_pop_min(value))
+                {
+                    local_popped += value.second;
+                }
+            }
+            pushed_sum += local_pushed;
+            popped_sum += local_popped;
+        });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> consumption = end - start;
+
+    typename Queue::value_type value;
+    while (queue.try_pop_min(value))
+    {
+        popped_sum += value.second;
+    }
+    success = success && pushed_sum.load() == popped_sum.load();
+    return 2.0 * thread_count * ops_per_thread / consumption.count() / 1e6;
+}
+
+int main()
+{
+    constexpr int ordering_items = 20000;
+    threadsafe_priority_queue<int, int> ordering_queue(8);
+    std::mt19937 gen(42);
+    for (int i = 0; i < ordering_items; ++i)
+    {
+        ordering_queue.push(static_cast<int>(gen() % ordering_items), i);
+    }
+    std::vector<int> popped;
+    threadsafe_priority_queue<int, int>::value_type value;
+    while (ordering_queue.try_pop_min(value))
+    {
+        popped.push_back(value.first);
+    }
+    std::vector<int> sorted(popped);
+    std::sort(sorted.begin(), sorted.end());
+    double rank_error = 0;
+    for (std::size_t i = 0; i < popped.size(); ++i)
+    {
+        auto const rank = std::lower_bound(sorted.begin(), sorted.end(), popped[i]) - sorted.begin();
+        rank_error += std::abs(static_cast<double>(rank) - static_cast<double>(i));
+    }
+    rank_error /= ordering_items;
+
+    threadsafe_priority_queue<int, int> blocking_queue;
+    long long blocking_sum = 0;
+    std::thread consumer([&]() {
+        for (int i = 0; i < 1000; ++i)
+        {
+            blocking_sum += blocking_queue.wait_pop_min()->second;
+        }
+    });
+    std::thread producer([&]() {
+        for (int i = 1; i <= 1000; ++i)
+        {
+            blocking_queue.push(1000 - i, i);
+        }
+    });
+    producer.join();
+    consumer.join();
+
+    bool success = popped.size() == ordering_items && blocking_sum == 500500 && blocking_queue.empty();
+    for (unsigned int threads = 1; threads <= 32; threads *= 2)
+    {
+        threadsafe_priority_queue<int, int> multi_queue;
+        locked_priority_queue<int, int> single_queue;
+        double const multi_rate = measure_throughput(multi_queue, threads, 50000, success);
+        double const single_rate = measure_throughput(single_queue, threads, 50000, success);
+        std::cout << threads << " threads: threadsafe_priority_queue " << multi_rate << " Mops/s, single locked heap " << single_rate << " Mops/s.\n";
+    }
+    std::cout << "Test threadsafe_priority_queue " << (success ? "successfully.\n" : "unsuccessfully.\n");
+    std::cout << "Heaps: " << ordering_queue.heaps_size() << ", mean rank error of pop_min: " << rank_error << ".\n";
+
+    return 0;
+}
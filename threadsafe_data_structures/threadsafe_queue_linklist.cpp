@@ -5,6 +5,11 @@
 #include <queue>
 #include <memory>
 #include <vector>
+#include <string>
+#include <chrono>
+#include <iterator>
+#include <atomic>
+#include <limits>
 
 template <typename T>
 class threadsafe_queue
@@ -19,6 +24,113 @@ private:
     node *tail;
     std::mutex head_mutex, tail_mutex;
     std::condition_variable data_cond;
+    std::size_t const capacity;
+    std::atomic<std::size_t> count;
+    std::atomic<unsigned int> waiting_producers;
+    std::atomic<unsigned int> waiting_consumers;
+    std::mutex not_full_mutex;
+    std::condition_variable not_full_cond;
+
+    static constexpr std::size_t unbounded = std::numeric_limits<std::size_t>::max();
+
+    std::size_t try_reserve(std::size_t n)
+    {
+        if (capacity == unbounded)
+        {
+            return n;
+        }
+        std::size_t cur = count.load();
+        do
+        {
+            if (cur >= capacity)
+            {
+                return 0;
+            }
+        } while (!count.compare_exchange_weak(cur, cur + std::min(n, capacity - cur)));
+        return std::min(n, capacity - cur);
+    }
+
+    template <typename Wait>
+    std::size_t reserve_slots(std::size_t n, Wait wait)
+    {
+        std::size_t granted = try_reserve(n);
+        if (granted)
+        {
+            return granted;
+        }
+        std::unique_lock<std::mutex> not_full_lock(not_full_mutex);
+        ++waiting_producers;
+        wait(not_full_lock, [&]{ return (granted = try_reserve(n)) != 0; });
+        --waiting_producers;
+        return granted;
+    }
+
+    std::size_t reserve_slots(std::size_t n)
+    {
+        return reserve_slots(n, [this](std::unique_lock<std::mutex> &lk, auto ready) { not_full_cond.wait(lk, ready); });
+    }
+
+    void release_slots(std::size_t n)
+    {
+        if (capacity == unbounded || n == 0)
+        {
+            return;
+        }
+        count.fetch_sub(n);
+        if (waiting_producers.load())
+        {
+            {
+                std::lock_guard<std::mutex> not_full_lock(not_full_mutex);
+            }
+            if (n == 1)
+            {
+                not_full_cond.notify_one();
+                return;
+            }
+            not_full_cond.notify_all();
+        }
+    }
+
+    // The slot is already reserved; if building the node throws, it is handed back before the exception escapes.
+    void link_value(T new_value)
+    {
+        std::shared_ptr<T> new_data;
+        std::unique_ptr<node> p;
+        try
+        {
+            new_data = std::make_shared<T>(std::move(new_value));
+            p.reset(new node);
+        }
+        catch (...)
+        {
+            release_slots(1);
+            throw;
+        }
+        {
+            std::lock_guard<std::mutex> tail_lock(tail_mutex);
+            tail->data = new_data;
+            node *const new_tail = p.get();
+            tail->next = std::move(p), tail = new_tail;
+        }
+        notify_consumers(false);
+    }
+
+    void notify_consumers(bool all)
+    {
+        if (!waiting_consumers.load())
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> head_lock(head_mutex);
+        }
+        if (all)
+        {
+            data_cond.notify_all();
+            return;
+        }
+        data_cond.notify_one();
+    }
 
     node *get_tail()
     {
@@ -36,8 +148,13 @@ private:
     std::unique_lock<std::mutex> wait_for_data()
     {
         std::unique_lock<std::mutex> head_lock(head_mutex);
-        data_cond.wait(head_lock, [&]{ return head.get() != get_tail(); });
-        return std::move(head_lock);
+        if (head.get() == get_tail())
+        {
+            ++waiting_consumers;
+            data_cond.wait(head_lock, [&]{ return head.get() != get_tail(); });
+            --waiting_consumers;
+        }
+        return head_lock;
     }
 
     std::unique_ptr<node> wait_pop_head()
@@ -65,8 +182,62 @@ private:
         return head.get() != get_tail() ? (value = std::move(*(head->data)), pop_head()) : std::unique_ptr<node>();
     }
 
+    std::unique_ptr<node> pop_head_run(std::size_t max_count, std::size_t &count)
+    {
+        node *const old_tail = get_tail();
+        node *last = head.get();
+        count = 0;
+        if (max_count == 0 || last == old_tail)
+        {
+            return std::unique_ptr<node>();
+        }
+        count = 1;
+        while (count < max_count && last->next.get() != old_tail)
+        {
+            last = last->next.get(), ++count;
+        }
+        std::unique_ptr<node> run = std::move(head);
+        head = std::move(last->next);
+        return run;
+    }
+
+    // If out throws, the nodes not yet delivered, the one being written included, go back to the front of the queue so
+    // no popped item is lost.
+    template <typename OutputIterator>
+    void drain_run(std::unique_ptr<node> run, OutputIterator out)
+    {
+        try
+        {
+            while (run)
+            {
+                *out++ = std::move(*(run->data));
+                run = std::move(run->next);
+            }
+        }
+        catch (...)
+        {
+            std::size_t remaining = 1;
+            node *last = run.get();
+            for (; last->next; last = last->next.get())
+            {
+                ++remaining;
+            }
+            {
+                std::lock_guard<std::mutex> head_lock(head_mutex);
+                last->next = std::move(head);
+                head = std::move(run);
+            }
+            if (capacity != unbounded)
+            {
+                count.fetch_add(remaining);
+            }
+            notify_consumers(remaining > 1);
+            throw;
+        }
+    }
+
 public:
-    threadsafe_queue() : head(new node), tail(head.get()) {}
+    explicit threadsafe_queue(std::size_t _capacity = unbounded) : head(new node), tail(head.get()), capacity(_capacity), count(0), waiting_producers(0), waiting_consumers(0) {}
 
     threadsafe_queue(const threadsafe_queue &other) = delete;
 
@@ -74,38 +245,134 @@ public:
 
     void push(T new_value)
     {
-        std::shared_ptr<T> new_data(std::make_shared<T>(std::move(new_value)));
-        std::unique_ptr<node> p(new node);
+        reserve_slots(1);
+        link_value(std::move(new_value));
+    }
+
+    bool try_push(T new_value)
+    {
+        if (!try_reserve(1))
         {
-            std::lock_guard<std::mutex> tail_lock(tail_mutex);
-            tail->data = new_data;
-            node *const new_tail = p.get();
-            tail->next = std::move(p), tail = new_tail;
+            return false;
         }
-        data_cond.notify_one();
+        link_value(std::move(new_value));
+        return true;
+    }
+
+    template <typename Rep, typename Period>
+    bool push_for(T new_value, std::chrono::duration<Rep, Period> const &timeout)
+    {
+        auto const deadline = std::chrono::steady_clock::now() + timeout;
+        if (!reserve_slots(1, [&](std::unique_lock<std::mutex> &lk, auto ready) { not_full_cond.wait_until(lk, deadline, ready); }))
+        {
+            return false;
+        }
+        link_value(std::move(new_value));
+        return true;
+    }
+
+    template <typename InputIterator>
+    void push_range(InputIterator first, InputIterator last)
+    {
+        while (first != last)
+        {
+            std::size_t const granted = reserve_slots(unbounded);
+            std::shared_ptr<T> first_data;
+            std::unique_ptr<node> chain;
+            node *chain_tail = nullptr;
+            std::size_t linked = 1;
+            try
+            {
+                first_data = std::make_shared<T>(*first);
+                chain.reset(new node);
+                chain_tail = chain.get();
+                for (++first; first != last && linked < granted; ++first, ++linked)
+                {
+                    chain_tail->data = std::make_shared<T>(*first);
+                    chain_tail->next.reset(new node);
+                    chain_tail = chain_tail->next.get();
+                }
+            }
+            catch (...)
+            {
+                release_slots(granted);
+                throw;
+            }
+            release_slots(granted - linked);
+            {
+                std::lock_guard<std::mutex> tail_lock(tail_mutex);
+                tail->data = first_data;
+                tail->next = std::move(chain), tail = chain_tail;
+            }
+            notify_consumers(linked > 1);
+        }
+    }
+
+    template <typename OutputIterator>
+    std::size_t try_pop_up_to(std::size_t n, OutputIterator out)
+    {
+        std::size_t popped = 0;
+        std::unique_ptr<node> run;
+        {
+            std::lock_guard<std::mutex> head_lock(head_mutex);
+            run = pop_head_run(n, popped);
+        }
+        release_slots(popped);
+        drain_run(std::move(run), out);
+        return popped;
+    }
+
+    template <typename OutputIterator>
+    std::size_t wait_pop_up_to(std::size_t n, OutputIterator out)
+    {
+        if (n == 0)
+        {
+            return 0;
+        }
+        std::size_t popped = 0;
+        std::unique_ptr<node> run;
+        {
+            std::unique_lock<std::mutex> head_lock(wait_for_data());
+            run = pop_head_run(n, popped);
+        }
+        release_slots(popped);
+        drain_run(std::move(run), out);
+        return popped;
     }
 
     std::shared_ptr<T> wait_and_pop()
     {
         std::unique_ptr<node> const old_head = wait_pop_head();
+        release_slots(1);
         return old_head->data;
     }
 
     void wait_and_pop(T &value)
     {
         std::unique_ptr<node> const old_head = wait_pop_head(value);
+        release_slots(1);
     }
 
     std::shared_ptr<T> try_pop()
     {
         std::unique_ptr<node> old_head = try_pop_head();
-        return old_head ? old_head->data : std::shared_ptr<T>();
+        if (!old_head)
+        {
+            return std::shared_ptr<T>();
+        }
+        release_slots(1);
+        return old_head->data;
     }
 
     bool try_pop(T &value)
     {
         std::unique_ptr<node> const old_head = try_pop_head(value);
-        return old_head != nullptr;
+        if (!old_head)
+        {
+            return false;
+        }
+        release_slots(1);
+        return true;
     }
 
     bool empty()
@@ -146,5 +413,78 @@ int main()
     t1.join();
     t2.join();
 
+    threadsafe_queue<int> batch_queue;
+    constexpr int total_items = 100000;
+    constexpr int batch_size = 1000;
+    long long popped_sum = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::thread t3([&]() {
+        std::vector<int> batch(batch_size);
+        for (int i = 0; i < total_items; i += batch_size)
+        {
+            for (int j = 0; j < batch_size; ++j)
+            {
+                batch[j] = i + j + 1;
+            }
+            batch_queue.push_range(batch.begin(), batch.end());
+        }
+    });
+
+    std::thread t4([&]() {
+        std::vector<int> received;
+        received.reserve(batch_size);
+        int popped = 0;
+        while (popped < total_items)
+        {
+            received.clear();
+            popped += batch_queue.wait_pop_up_to(batch_size, std::back_inserter(received));
+            for (int value : received)
+            {
+                popped_sum += value;
+            }
+        }
+    });
+    t3.join();
+    t4.join();
+    const auto end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double, std::milli> consumption = end - start;
+
+    bool const success = popped_sum == 1LL * total_items * (total_items + 1) / 2 && batch_queue.empty();
+    std::cout << "Test threadsafe_queue push_range and wait_pop_up_to " << (success ? "successfully.\n" : "unsuccessfully.\n");
+    std::cout << "Total consuming times: " << consumption.count() << "ms.\n";
+
+    threadsafe_queue<int> bounded_queue(64);
+    long long bounded_sum = 0;
+    std::thread t5([&]() {
+        std::vector<int> batch(batch_size);
+        for (int i = 0; i < total_items; i += batch_size)
+        {
+            for (int j = 0; j < batch_size; ++j)
+            {
+                batch[j] = i + j + 1;
+            }
+            bounded_queue.push_range(batch.begin(), batch.end());
+        }
+    });
+    std::thread t6([&]() {
+        for (int i = 0; i < total_items; ++i)
+        {
+            int value = 0;
+            bounded_queue.wait_and_pop(value);
+            bounded_sum += value;
+        }
+    });
+    t5.join();
+    t6.join();
+
+    for (int i = 0; i < 64; ++i)
+    {
+        bounded_queue.push(i);
+    }
+    bool const rejected = !bounded_queue.try_push(64) && !bounded_queue.push_for(64, std::chrono::milliseconds(10));
+    bool const bounded_success = bounded_sum == 1LL * total_items * (total_items + 1) / 2 && rejected;
+    std::cout << "Test bounded threadsafe_queue " << (bounded_success ? "successfully.\n" : "unsuccessfully.\n");
+
     return 0;
 }
@@ -8,6 +8,48 @@
 #include <functional>
 #include <unordered_set>
 
+class eventcount
+{
+private:
+    std::atomic<unsigned int> epoch;
+    std::atomic<unsigned int> waiters;
+
+public:
+    eventcount() : epoch(0), waiters(0) {}
+
+    eventcount(eventcount const &other) = delete;
+
+    eventcount &operator=(eventcount const &other) = delete;
+
+    unsigned int prepare_wait()
+    {
+        waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_acquire);
+    }
+
+    void cancel_wait()
+    {
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void commit_wait(unsigned int key)
+    {
+        epoch.wait(key, std::memory_order_acquire);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify_one()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) != 0)
+        {
+            epoch.fetch_add(1, std::memory_order_release);
+            epoch.notify_one();
+        }
+    }
+};
+
 template <typename T>
 class shared_pointer_atomic_stack
 {
@@ -19,6 +61,7 @@ private:
         node(T const &_data) : data(std::make_shared<T>(_data)) {}
     };
     std::shared_ptr<node> head;
+    eventcount data_event;
 
     shared_pointer_atomic_stack(const shared_pointer_atomic_stack &) = delete;
     shared_pointer_atomic_stack &operator=(const shared_pointer_atomic_stack &) = delete;
@@ -31,6 +74,7 @@ public:
         std::shared_ptr<node> const new_node = std::make_shared<node>(val);
         new_node->next = std::atomic_load(&head);
         while (!std::atomic_compare_exchange_weak(&head, &new_node->next, new_node)) continue;
+        data_event.notify_one();
     }
 
     std::shared_ptr<T> pop()
@@ -45,6 +89,24 @@ public:
         return std::shared_ptr<T>();
     }
 
+    std::shared_ptr<T> wait_pop()
+    {
+        for (;;)
+        {
+            if (std::shared_ptr<T> res = pop())
+            {
+                return res;
+            }
+            unsigned int const key = data_event.prepare_wait();
+            if (std::shared_ptr<T> res = pop())
+            {
+                data_event.cancel_wait();
+                return res;
+            }
+            data_event.commit_wait(key);
+        }
+    }
+
     ~shared_pointer_atomic_stack()
     {
         while (pop()) continue;
@@ -67,34 +129,42 @@ int main()
     });
 
     std::thread t2([&]() {
-        while (rmset.size() < 10)
+        for (;;)
         {
-            auto hd = test_stack.pop();
-            if (!hd)
+            auto hd = test_stack.wait_pop();
+            if (*hd == 0)
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
+                break;
             }
             std::lock_guard<std::mutex> lk(mtx);
             rmset.insert(*hd);
             std::string str = "Pop value: " + std::to_string(*hd) + " from shared_pointer_atomic_stack successfully.\n";
             std::cout << str;
+            if (rmset.size() == 10)
+            {
+                test_stack.push(0);
+                break;
+            }
         }
     });
 
     std::thread t3([&]() {
-        while (rmset.size() < 10)
+        for (;;)
         {
-            auto hd = test_stack.pop();
-            if (!hd)
+            auto hd = test_stack.wait_pop();
+            if (*hd == 0)
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
+                break;
             }
             std::lock_guard<std::mutex> lk(mtx);
             rmset.insert(*hd);
             std::string str = "Pop value: " + std::to_string(*hd) + " from shared_pointer_atomic_stack successfully.\n";
             std::cout << str;
+            if (rmset.size() == 10)
+            {
+                test_stack.push(0);
+                break;
+            }
         }
     });
 
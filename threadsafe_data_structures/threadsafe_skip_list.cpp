@@ -0,0 +1,509 @@
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <optional>
+#include <functional>
+
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+class threadsafe_skip_list
+{
+public:
+    using value_type = std::pair<Key const, Value>;
+
+private:
+    static constexpr int max_level = 16;
+
+    struct node
+    {
+        std::optional<value_type> data;
+        int const top_level;
+        std::unique_ptr<std::atomic<node *>[]> next;
+        std::atomic<bool> marked;
+        std::atomic<bool> fully_linked;
+        std::mutex mtx;
+        node *next_to_be_deleted;
+
+        explicit node(int _top_level) : top_level(_top_level), next(new std::atomic<node *>[_top_level]), marked(false), fully_linked(false), next_to_be_deleted(nullptr)
+        {
+            for (int i = 0; i < top_level; ++i)
+            {
+                next[i].store(nullptr);
+            }
+        }
+
+        node(Key const &key, Value const &value, int _top_level) : node(_top_level)
+        {
+            data.emplace(key, value);
+        }
+
+        Key const &key() const
+        {
+            return data->first;
+        }
+    };
+    mutable node head;
+    Compare comp;
+    std::atomic<std::size_t> count;
+    mutable std::atomic<unsigned int> threads_in_list;
+    mutable std::atomic<node *> to_be_deleted;
+
+    class access_guard
+    {
+    private:
+        threadsafe_skip_list const *list;
+
+    public:
+        explicit access_guard(threadsafe_skip_list const *_list) : list(_list)
+        {
+            if (list)
+            {
+                list->enter();
+            }
+        }
+
+        access_guard(access_guard const &other) : access_guard(other.list) {}
+
+        access_guard &operator=(access_guard const &other)
+        {
+            access_guard(other).swap(*this);
+            return *this;
+        }
+
+        ~access_guard()
+        {
+            if (list)
+            {
+                list->leave();
+            }
+        }
+
+        void swap(access_guard &other) noexcept
+        {
+            std::swap(list, other.list);
+        }
+
+        void release()
+        {
+            if (list)
+            {
+                list->leave();
+                list = nullptr;
+            }
+        }
+    };
+
+    static int random_level()
+    {
+        thread_local std::mt19937 generator(std::random_device{}());
+        unsigned int bits = generator();
+        int level = 1;
+        while ((bits & 1) && level < max_level)
+        {
+            bits >>= 1, ++level;
+        }
+        return level;
+    }
+
+    static void delete_nodes(node *nodes)
+    {
+        while (nodes)
+        {
+            node *ne = nodes->next_to_be_deleted;
+            delete nodes;
+            nodes = ne;
+        }
+    }
+
+    void chain_pending_nodes(node *first, node *last) const
+    {
+        last->next_to_be_deleted = to_be_deleted.load();
+        while (!to_be_deleted.compare_exchange_weak(last->next_to_be_deleted, first)) continue;
+    }
+
+    void chain_pending_nodes(node *nodes) const
+    {
+        node *last = nodes;
+        while (node *const ne = last->next_to_be_deleted)
+        {
+            last = ne;
+        }
+        chain_pending_nodes(nodes, last);
+    }
+
+    void enter() const
+    {
+        ++threads_in_list;
+    }
+
+    void leave() const
+    {
+        if (threads_in_list == 1)
+        {
+            node *nodes_to_delete = to_be_deleted.exchange(nullptr);
+            if (--threads_in_list == 0)
+            {
+                delete_nodes(nodes_to_delete);
+            }
+            else if (nodes_to_delete)
+            {
+                chain_pending_nodes(nodes_to_delete);
+            }
+            return;
+        }
+        --threads_in_list;
+    }
+
+    bool less(node const *nd, Key const &key) const
+    {
+        return nd && comp(nd->key(), key);
+    }
+
+    int find_node(Key const &key, node **preds, node **succs) const
+    {
+        int found_level = -1;
+        node *pred = &head;
+        for (int level = max_level - 1; level >= 0; --level)
+        {
+            node *cur = pred->next[level].load();
+            while (less(cur, key))
+            {
+                pred = cur, cur = pred->next[level].load();
+            }
+            if (found_level == -1 && cur && !comp(key, cur->key()))
+            {
+                found_level = level;
+            }
+            preds[level] = pred, succs[level] = cur;
+        }
+        return found_level;
+    }
+
+    static bool is_live(node const *nd)
+    {
+        return nd->fully_linked.load() && !nd->marked.load();
+    }
+
+    static node *first_live(node *nd)
+    {
+        while (nd && !is_live(nd))
+        {
+            nd = nd->next[0].load();
+        }
+        return nd;
+    }
+
+    static void lock_predecessors(node **preds, int top_level, std::vector<std::unique_lock<std::mutex>> &locks)
+    {
+        node *prev_pred = nullptr;
+        for (int level = 0; level < top_level; ++level)
+        {
+            if (preds[level] != prev_pred)
+            {
+                locks.emplace_back(preds[level]->mtx);
+                prev_pred = preds[level];
+            }
+        }
+    }
+
+public:
+    class const_iterator
+    {
+    private:
+        friend class threadsafe_skip_list;
+        access_guard guard;
+        node *cur;
+
+        const_iterator(threadsafe_skip_list const *list, node *nd) : guard(nd ? list : nullptr), cur(nd) {}
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename threadsafe_skip_list::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = value_type const *;
+        using reference = value_type const &;
+
+        const_iterator() : guard(nullptr), cur(nullptr) {}
+
+        reference operator*() const
+        {
+            return *cur->data;
+        }
+
+        pointer operator->() const
+        {
+            return &*cur->data;
+        }
+
+        const_iterator &operator++()
+        {
+            cur = first_live(cur->next[0].load());
+            if (!cur)
+            {
+                guard.release();
+            }
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator res(*this);
+            ++*this;
+            return res;
+        }
+
+        friend bool operator==(const_iterator const &lhs, const_iterator const &rhs)
+        {
+            return lhs.cur == rhs.cur;
+        }
+
+        friend bool operator!=(const_iterator const &lhs, const_iterator const &rhs)
+        {
+            return lhs.cur != rhs.cur;
+        }
+    };
+
+    threadsafe_skip_list(Compare const &_comp = Compare()) : head(max_level), comp(_comp), count(0), threads_in_list(0), to_be_deleted(nullptr)
+    {
+        head.fully_linked.store(true);
+    }
+
+    threadsafe_skip_list(threadsafe_skip_list const &other) = delete;
+
+    threadsafe_skip_list &operator=(threadsafe_skip_list const &other) = delete;
+
+    ~threadsafe_skip_list()
+    {
+        node *cur = head.next[0].load();
+        while (cur)
+        {
+            node *ne = cur->next[0].load();
+            delete cur;
+            cur = ne;
+        }
+        delete_nodes(to_be_deleted.load());
+    }
+
+    bool insert(Key const &key, Value const &value)
+    {
+        access_guard guard(this);
+        int const top_level = random_level();
+        node *preds[max_level], *succs[max_level];
+        for (;;)
+        {
+            int const found_level = find_node(key, preds, succs);
+            if (found_level != -1)
+            {
+                node *const found = succs[found_level];
+                if (!found->marked.load())
+                {
+                    while (!found->fully_linked.load()) continue;
+                    return false;
+                }
+                continue;
+            }
+            std::vector<std::unique_lock<std::mutex>> locks;
+            lock_predecessors(preds, top_level, locks);
+            bool valid = true;
+            for (int level = 0; valid && level < top_level; ++level)
+            {
+                valid = !preds[level]->marked.load() && (!succs[level] || !succs[level]->marked.load()) && preds[level]->next[level].load() == succs[level];
+            }
+            if (!valid)
+            {
+                continue;
+            }
+            node *const new_node = new node(key, value, top_level);
+            for (int level = 0; level < top_level; ++level)
+            {
+                new_node->next[level].store(succs[level]);
+            }
+            for (int level = 0; level < top_level; ++level)
+            {
+                preds[level]->next[level].store(new_node);
+            }
+            new_node->fully_linked.store(true);
+            ++count;
+            return true;
+        }
+    }
+
+    bool erase(Key const &key)
+    {
+        access_guard guard(this);
+        node *preds[max_level], *succs[max_level];
+        node *victim = nullptr;
+        std::unique_lock<std::mutex> victim_lock;
+        for (;;)
+        {
+            int const found_level = find_node(key, preds, succs);
+            if (!victim_lock.owns_lock())
+            {
+                if (found_level == -1)
+                {
+                    return false;
+                }
+                victim = succs[found_level];
+                if (!victim->fully_linked.load() || victim->top_level - 1 != found_level || victim->marked.load())
+                {
+                    return false;
+                }
+                victim_lock = std::unique_lock<std::mutex>(victim->mtx);
+                if (victim->marked.load())
+                {
+                    return false;
+                }
+                victim->marked.store(true);
+            }
+            std::vector<std::unique_lock<std::mutex>> locks;
+            lock_predecessors(preds, victim->top_level, locks);
+            bool valid = true;
+            for (int level = 0; valid && level < victim->top_level; ++level)
+            {
+                valid = !preds[level]->marked.load() && preds[level]->next[level].load() == victim;
+            }
+            if (!valid)
+            {
+                continue;
+            }
+            for (int level = victim->top_level - 1; level >= 0; --level)
+            {
+                preds[level]->next[level].store(victim->next[level].load());
+            }
+            victim_lock.unlock();
+            --count;
+            chain_pending_nodes(victim, victim);
+            return true;
+        }
+    }
+
+    bool contains(Key const &key) const
+    {
+        access_guard guard(this);
+        node *preds[max_level], *succs[max_level];
+        int const found_level = find_node(key, preds, succs);
+        return found_level != -1 && is_live(succs[found_level]);
+    }
+
+    const_iterator find(Key const &key) const
+    {
+        access_guard guard(this);
+        node *preds[max_level], *succs[max_level];
+        int const found_level = find_node(key, preds, succs);
+        if (found_level != -1 && is_live(succs[found_level]))
+        {
+            return const_iterator(this, succs[found_level]);
+        }
+        return end();
+    }
+
+    const_iterator lower_bound(Key const &key) const
+    {
+        access_guard guard(this);
+        node *preds[max_level], *succs[max_level];
+        find_node(key, preds, succs);
+        return const_iterator(this, first_live(succs[0]));
+    }
+
+    const_iterator begin() const
+    {
+        access_guard guard(this);
+        return const_iterator(this, first_live(head.next[0].load()));
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator();
+    }
+
+    template <typename Function>
+    void for_each_in_range(Key const &low, Key const &high, Function f) const
+    {
+        for (auto it = lower_bound(low); it != end() && comp(it->first, high); ++it)
+        {
+            f(*it);
+        }
+    }
+
+    std::size_t size() const
+    {
+        return count.load();
+    }
+};
+
+int main()
+{
+    threadsafe_skip_list<int, std::string> test_list;
+    std::atomic<bool> scanning(true);
+    std::atomic<int> unordered_scans(0);
+
+    std::thread t1([&]() {
+        for (int i = 0; i < 10000; i += 2)
+        {
+            test_list.insert(i, std::to_string(i));
+        }
+    });
+
+    std::thread t2([&]() {
+        for (int i = 1; i < 10000; i += 2)
+        {
+            test_list.insert(i, std::to_string(i));
+        }
+    });
+
+    std::thread t3([&]() {
+        for (int i = 0; i < 10000; i += 3)
+        {
+            while (!test_list.contains(i)) std::this_thread::yield();
+            test_list.erase(i);
+        }
+    });
+
+    std::thread t4([&]() {
+        while (scanning.load())
+        {
+            int prev = -1;
+            test_list.for_each_in_range(100, 5000, [&](std::pair<int const, std::string> const &item) {
+                if (item.first <= prev || std::to_string(item.first) != item.second)
+                {
+                    ++unordered_scans;
+                }
+                prev = item.first;
+            });
+        }
+    });
+
+    const auto start = std::chrono::steady_clock::now();
+    t1.join();
+    t2.join();
+    t3.join();
+    scanning.store(false);
+    t4.join();
+    const auto end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double, std::milli> consumption = end - start;
+
+    std::size_t expected = 0;
+    for (int i = 0; i < 10000; ++i)
+    {
+        expected += (i % 3 != 0);
+    }
+    std::size_t visited = 0;
+    for (auto it = test_list.begin(); it != test_list.end(); ++it)
+    {
+        ++visited;
+    }
+    auto next_after = test_list.lower_bound(3000);
+    std::cout << "First key not less than 3000: " << next_after->first << "\n";
+    bool const success = unordered_scans.load() == 0 && visited == expected && test_list.size() == expected && !test_list.contains(3000) && test_list.find(3001) != test_list.end();
+    std::cout << "Test threadsafe_skip_list " << (success ? "successfully.\n" : "unsuccessfully.\n");
+    std::cout << "Total consuming times: " << consumption.count() << "ms.\n";
+
+    return 0;
+}
@@ -0,0 +1,298 @@
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <new>
+#include <string>
+#include <utility>
+#include <algorithm>
+
+template <typename T, std::size_t BlockSize = std::max<std::size_t>(4, 512 / sizeof(T))>
+class threadsafe_unrolled_list
+{
+private:
+    struct node;
+
+    // The head sentinel is only a lock and a pointer, so it does not carry a slot array of its own.
+    struct link
+    {
+        std::mutex mtx;
+        std::unique_ptr<node> next;
+    };
+
+    struct node : link
+    {
+        std::size_t count;
+        alignas(T) unsigned char storage[BlockSize * sizeof(T)];
+
+        node() : count(0) {}
+
+        ~node()
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                item(i)->~T();
+            }
+        }
+
+        T *item(std::size_t i)
+        {
+            return std::launder(reinterpret_cast<T *>(storage) + i);
+        }
+
+        void move_item(std::size_t from, std::size_t to)
+        {
+            new (storage + to * sizeof(T)) T(std::move(*item(from)));
+            item(from)->~T();
+        }
+
+        // Slots [kept, from) are empty after a partial compaction. Slides [from, count) down so the live items are
+        // contiguous again; if a move throws, the items not yet moved are destroyed instead.
+        void close_gap(std::size_t kept, std::size_t from)
+        {
+            if (kept == from)
+            {
+                return;
+            }
+            try
+            {
+                for (; from < count; ++from, ++kept)
+                {
+                    move_item(from, kept);
+                }
+            }
+            catch (...)
+            {
+                for (; from < count; ++from)
+                {
+                    item(from)->~T();
+                }
+                count = kept;
+                throw;
+            }
+            count = kept;
+        }
+
+        template <typename Predicate>
+        void remove_items_if(Predicate &p)
+        {
+            std::size_t kept = 0;
+            std::size_t i = 0;
+            try
+            {
+                for (; i < count; ++i)
+                {
+                    if (p(static_cast<T const &>(*item(i))))
+                    {
+                        item(i)->~T();
+                    }
+                    else
+                    {
+                        if (kept != i)
+                        {
+                            move_item(i, kept);
+                        }
+                        ++kept;
+                    }
+                }
+            }
+            catch (...)
+            {
+                close_gap(kept, i);
+                throw;
+            }
+            count = kept;
+        }
+
+        void absorb_older(node &older)
+        {
+            for (std::size_t i = count; i-- > 0;)
+            {
+                move_item(i, i + older.count);
+            }
+            for (std::size_t i = 0; i < older.count; ++i)
+            {
+                new (storage + i * sizeof(T)) T(std::move(*older.item(i)));
+                older.item(i)->~T();
+            }
+            count += older.count;
+            older.count = 0;
+        }
+    };
+    link head;
+
+public:
+    threadsafe_unrolled_list() {}
+
+    ~threadsafe_unrolled_list()
+    {
+        std::unique_ptr<node> cur = std::move(head.next);
+        while (cur)
+        {
+            cur = std::move(cur->next);
+        }
+    }
+
+    threadsafe_unrolled_list(threadsafe_unrolled_list const &other) = delete;
+
+    threadsafe_unrolled_list &operator=(threadsafe_unrolled_list const &other) = delete;
+
+    static constexpr std::size_t block_size()
+    {
+        return BlockSize;
+    }
+
+    static constexpr std::size_t node_bytes()
+    {
+        return sizeof(node);
+    }
+
+    void push_front(T const &value)
+    {
+        std::lock_guard<std::mutex> lk(head.mtx);
+        if (node *const first = head.next.get())
+        {
+            std::lock_guard<std::mutex> first_lk(first->mtx);
+            if (first->count < BlockSize)
+            {
+                new (first->storage + first->count * sizeof(T)) T(value);
+                ++first->count;
+                return;
+            }
+        }
+        std::unique_ptr<node> new_node(new node);
+        new (new_node->storage) T(value);
+        new_node->count = 1;
+        new_node->next = std::move(head.next);
+        head.next = std::move(new_node);
+    }
+
+    template <typename Function>
+    void for_each(Function f)
+    {
+        link *cur = &head;
+        std::unique_lock<std::mutex> lk(head.mtx);
+        while (node *const ne = cur->next.get())
+        {
+            std::unique_lock<std::mutex> next_lk(ne->mtx);
+            lk.unlock();
+            for (std::size_t i = ne->count; i-- > 0;)
+            {
+                f(*ne->item(i));
+            }
+            cur = ne;
+            lk = std::move(next_lk);
+        }
+    }
+
+    template <typename Predicate>
+    std::shared_ptr<T> find_first_if(Predicate p)
+    {
+        link *cur = &head;
+        std::unique_lock<std::mutex> lk(head.mtx);
+        while (node *const ne = cur->next.get())
+        {
+            std::unique_lock<std::mutex> next_lk(ne->mtx);
+            lk.unlock();
+            for (std::size_t i = ne->count; i-- > 0;)
+            {
+                if (p(*ne->item(i)))
+                {
+                    return std::make_shared<T>(*ne->item(i));
+                }
+            }
+            cur = ne;
+            lk = std::move(next_lk);
+        }
+        return std::shared_ptr<T>();
+    }
+
+    template <typename Predicate>
+    void remove_if(Predicate p)
+    {
+        link *cur = &head;
+        node *prev_block = nullptr;
+        std::unique_lock<std::mutex> lk(head.mtx);
+        while (node *const ne = cur->next.get())
+        {
+            std::unique_lock<std::mutex> next_lk(ne->mtx);
+            ne->remove_items_if(p);
+            if (prev_block && prev_block->count + ne->count <= BlockSize)
+            {
+                prev_block->absorb_older(*ne);
+            }
+            if (ne->count == 0)
+            {
+                std::unique_ptr<node> old_next = std::move(cur->next);
+                cur->next = std::move(ne->next);
+                next_lk.unlock();
+            }
+            else
+            {
+                lk.unlock(), cur = prev_block = ne;
+                lk = std::move(next_lk);
+            }
+        }
+    }
+};
+
+int main()
+{
+    threadsafe_unrolled_list<int> test_list;
+
+    std::thread t1([&]() {
+        for (int i = 0; i < 100000; i += 2)
+        {
+            test_list.push_front(i);
+        }
+    });
+
+    std::thread t2([&]() {
+        for (int i = 1; i < 100000; i += 2)
+        {
+            test_list.push_front(i);
+        }
+    });
+    t1.join();
+    t2.join();
+
+    const auto start = std::chrono::steady_clock::now();
+    long long sum = 0;
+    test_list.for_each([&](int const &value) { sum += value; });
+    const auto end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double, std::micro> consumption = end - start;
+
+    std::thread t3([&]() {
+        test_list.remove_if([](int const &value) { return value % 3 == 0; });
+    });
+    std::thread t4([&]() {
+        for (int i = 100000; i < 110000; ++i)
+        {
+            test_list.push_front(i);
+        }
+    });
+    t3.join();
+    t4.join();
+    test_list.remove_if([](int const &value) { return value >= 100000; });
+
+    long long remaining = 0;
+    int count = 0;
+    test_list.for_each([&](int const &value) { remaining += value, ++count; });
+    long long expected_sum = 0;
+    int expected_count = 0;
+    for (int i = 0; i < 100000; ++i)
+    {
+        if (i % 3 != 0)
+        {
+            expected_sum += i, ++expected_count;
+        }
+    }
+    auto found = test_list.find_first_if([](int const &value) { return value == 99998; });
+    bool const success = sum == 4999950000LL && remaining == expected_sum && count == expected_count && found && *found == 99998;
+    std::cout << "Test threadsafe_unrolled_list " << (success ? "successfully.\n" : "unsuccessfully.\n");
+    std::cout << "Block size: " << test_list.block_size() << ", bytes per element: " << static_cast<double>(test_list.node_bytes()) / test_list.block_size() << ".\n";
+    std::cout << "Full scan of 100000 elements: " << consumption.count() << "us.\n";
+
+    return 0;
+}
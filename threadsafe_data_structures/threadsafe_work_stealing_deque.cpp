@@ -0,0 +1,292 @@
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
+#include <type_traits>
+
+template <typename T>
+class work_stealing_deque
+{
+    static_assert(std::is_trivially_copyable<T>::value, "work_stealing_deque stores T in atomic slots");
+
+private:
+    struct ring_buffer
+    {
+        std::int64_t const capacity;
+        std::int64_t const mask;
+        std::unique_ptr<std::atomic<T>[]> slots;
+
+        explicit ring_buffer(std::int64_t _capacity) : capacity(_capacity), mask(_capacity - 1), slots(new std::atomic<T>[_capacity]) {}
+
+        T get(std::int64_t i) const
+        {
+            return slots[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(std::int64_t i, T value)
+        {
+            slots[i & mask].store(value, std::memory_order_relaxed);
+        }
+
+        ring_buffer *grow(std::int64_t bottom, std::int64_t top) const
+        {
+            ring_buffer *const res = new ring_buffer(capacity * 2);
+            for (std::int64_t i = top; i != bottom; ++i)
+            {
+                res->put(i, get(i));
+            }
+            return res;
+        }
+    };
+    alignas(64) std::atomic<std::int64_t> top;
+    alignas(64) std::atomic<std::int64_t> bottom;
+    std::atomic<ring_buffer *> buffer;
+    std::vector<std::unique_ptr<ring_buffer>> retired;
+
+public:
+    explicit work_stealing_deque(std::int64_t initial_capacity = 64) : top(0), bottom(0)
+    {
+        std::int64_t capacity = 1;
+        while (capacity < initial_capacity)
+        {
+            capacity <<= 1;
+        }
+        buffer.store(new ring_buffer(capacity), std::memory_order_relaxed);
+    }
+
+    work_stealing_deque(work_stealing_deque const &other) = delete;
+
+    work_stealing_deque &operator=(work_stealing_deque const &other) = delete;
+
+    ~work_stealing_deque()
+    {
+        delete buffer.load(std::memory_order_relaxed);
+    }
+
+    void push(T value)
+    {
+        std::int64_t const b = bottom.load(std::memory_order_relaxed);
+        std::int64_t const t = top.load(std::memory_order_acquire);
+        ring_buffer *a = buffer.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1)
+        {
+            std::unique_ptr<ring_buffer> grown(a->grow(b, t));
+            retired.emplace_back(a);
+            a = grown.release();
+            buffer.store(a, std::memory_order_release);
+        }
+        a->put(b, value);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    std::optional<T> pop()
+    {
+        std::int64_t const b = bottom.load(std::memory_order_relaxed) - 1;
+        ring_buffer *const a = buffer.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        T value = a->get(b);
+        if (t == b)
+        {
+            bool const won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            if (!won)
+            {
+                return std::nullopt;
+            }
+        }
+        return value;
+    }
+
+    std::optional<T> steal()
+    {
+        std::int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t const b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+            return std::nullopt;
+        }
+        ring_buffer *const a = buffer.load(std::memory_order_acquire);
+        T value = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    bool empty() const
+    {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
+
+    std::size_t size() const
+    {
+        std::int64_t const n = bottom.load(std::memory_order_relaxed) - top.load(std::memory_order_relaxed);
+        return n > 0 ? static_cast<std::size_t>(n) : 0;
+    }
+
+    std::size_t capacity() const
+    {
+        return static_cast<std::size_t>(buffer.load(std::memory_order_relaxed)->capacity);
+    }
+};
+
+template <typename T>
+class locked_deque
+{
+private:
+    std::mutex mtx;
+    std::deque<T> items;
+
+public:
+    void push(T value)
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        items.push_back(value);
+    }
+
+    std::optional<T> pop()
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (items.empty())
+        {
+            return std::nullopt;
+        }
+        T value = items.back();
+        items.pop_back();
+        return value;
+    }
+
+    std::optional<T> steal()
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (items.empty())
+        {
+            return std::nullopt;
+        }
+        T value = items.front();
+        items.pop_front();
+        return value;
+    }
+};
+
+template <typename Deque>
+bool stress_test(Deque &deque, int total, unsigned int thief_count, double &milliseconds)
+{
+    std::vector<std::atomic<int>> taken(total);
+    std::atomic<int> taken_count(0);
+    std::vector<std::thread> thieves;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < thief_count; ++i)
+    {
+        thieves.emplace_back([&]() {
+            while (taken_count.load(std::memory_order_relaxed) < total)
+            {
+                if (std::optional<int> value = deque.steal())
+                {
+                    taken[*value].fetch_add(1, std::memory_order_relaxed);
+                    taken_count.fetch_add(1, std::memory_order_relaxed);
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (int i = 0; i < total; ++i)
+    {
+        deque.push(i);
+        if (i % 3 == 0)
+        {
+            if (std::optional<int> value = deque.pop())
+            {
+                taken[*value].fetch_add(1, std::memory_order_relaxed);
+                taken_count.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+    while (std::optional<int> value = deque.pop())
+    {
+        taken[*value].fetch_add(1, std::memory_order_relaxed);
+        taken_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    for (auto &t : thieves)
+    {
+        t.join();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+    for (int i = 0; i < total; ++i)
+    {
+        if (taken[i].load() != 1)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Deque>
+double owner_throughput(Deque &deque, int rounds)
+{
+    long long sum = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r)
+    {
+        for (int i = 0; i < 64; ++i)
+        {
+            deque.push(i);
+        }
+        while (std::optional<int> value = deque.pop())
+        {
+            sum += *value;
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> consumption = end - start;
+    return sum == 2016LL * rounds ? 128.0 * rounds / consumption.count() / 1e6 : 0.0;
+}
+
+int main()
+{
+    unsigned int const thief_count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    constexpr int total = 1000000;
+
+    work_stealing_deque<int> test_deque(8);
+    double deque_ms = 0;
+    bool const success = stress_test(test_deque, total, thief_count, deque_ms);
+    locked_deque<int> baseline_deque;
+    double baseline_ms = 0;
+    stress_test(baseline_deque, total, thief_count, baseline_ms);
+
+    work_stealing_deque<int> owner_deque;
+    locked_deque<int> owner_baseline;
+    double const owner_rate = owner_throughput(owner_deque, 100000);
+    double const baseline_rate = owner_throughput(owner_baseline, 100000);
+
+    std::cout << "Test work_stealing_deque " << (success && test_deque.empty() ? "successfully.\n" : "unsuccessfully.\n");
+    std::cout << "Grew from 8 to " << test_deque.capacity() << " slots.\n";
+    std::cout << "Stress with " << thief_count << " thieves: work_stealing_deque " << deque_ms << "ms, locked deque " << baseline_ms << "ms.\n";
+    std::cout << "Owner push/pop: work_stealing_deque " << owner_rate << " Mops/s, locked deque " << baseline_rate << " Mops/s.\n";
+
+    return 0;
+}